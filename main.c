@@ -1,14 +1,37 @@
+// Build with -DHEADLESS for a window-less simulation runner. That build only
+// needs the header-only raymath.h, not the raylib library or a GL context.
+// -DBENCHMARK builds the scaling benchmark instead, also window-less, and
+// -DBATCH the Monte Carlo batch runner.
+#if defined(BENCHMARK) || defined(BATCH)
+#define HEADLESS
+#endif
+#ifdef HEADLESS
+#include <stdbool.h>
+#define RAYMATH_STATIC_INLINE
+#else
 #include <raylib.h>
+#include <rlgl.h>
+#endif
 #include <stdlib.h>
 #include <math.h>
 #include <time.h>
 #include <raymath.h>
 #include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SIMD_SCANS
+#endif
 
-#define MAX_PROTESTERS 120
-#define MAX_POLICE 100
-#define MAX_PROJECTILES 1000
-#define MAX_BARRIERS 20
 #define SCREEN_WIDTH 1280
 #define SCREEN_HEIGHT 720
 #define ENTITY_SPEED 150.0f
@@ -46,17 +69,109 @@
 #define ANIMATION_DURATION 0.2f
 #define RETREAT_HEALTH_THRESHOLD 0.25f
 #define COVER_CYCLE_DURATION 5.0f
+#define COVER_SLOTS_PER_BARRIER 4
+#define COVER_SLOT_OFFSET (COVER_WIDTH + 2.0f)
 #define FLANKING_OFFSET 50.0f
 #define MORALE_PENALTY_DURATION 3.0f
 #define MORALE_PENALTY_FACTOR 0.7f
 #define DYING_DURATION 2.0f
+#define FIXED_DT (1.0f / 60.0f)
+#define MAX_STEPS_PER_FRAME 8
+#define SEPARATION_RADIUS 20.0f
+#define HIT_RADIUS 10.0f
+#define GRID_CELL_SIZE 50
+#define GRID_COLS (SCREEN_WIDTH / GRID_CELL_SIZE + 1)
+#define GRID_ROWS (SCREEN_HEIGHT / GRID_CELL_SIZE + 1)
+#define GRID_CELLS (GRID_COLS * GRID_ROWS)
+#define GRID_SLACK 16.0f
+#define BARRIER_REACH (BARRIER_AVOIDANCE_RANGE + 1.0f)
+#define LOD_INTERVAL 4
+#define FLOW_CELL_SIZE 10
+#define FLOW_COLS (SCREEN_WIDTH / FLOW_CELL_SIZE)
+#define FLOW_ROWS (SCREEN_HEIGHT / FLOW_CELL_SIZE)
+#define FLOW_CELLS (FLOW_COLS * FLOW_ROWS)
+#define FLOW_CLEARANCE (COVER_WIDTH + FLOW_CELL_SIZE * 0.75f)
+#define DENSITY_BIN_SIZE 25
+#define DENSITY_COLS (SCREEN_WIDTH / DENSITY_BIN_SIZE + 1)
+#define DENSITY_ROWS (SCREEN_HEIGHT / DENSITY_BIN_SIZE + 1)
+#define DENSITY_BINS (DENSITY_COLS * DENSITY_ROWS)
+#define DENSITY_SAT_SIZE ((DENSITY_COLS + 1) * (DENSITY_ROWS + 1))
+#define MIN_STORE_CAPACITY 64
+#define MAX_THREADS 64
+#define AI_CHUNK_SIZE 8
+#define PROJECTILE_CHUNK_SIZE 64
+#define MAX_TASKS 32
+#define MAX_TASK_SUCCESSORS 8
+#define WORK_QUEUE_SIZE 256
+#define MAX_SHOTS_PER_UPDATE 3
+#define TELEMETRY_RING_SIZE 4096
 
 typedef enum { PROTESTER, POLICE } EntityType;
 typedef enum { IDLE, MOVING, ATTACKING, RETREATING, TAKING_COVER, DYING } AIState;
 typedef enum { SHOOTER, MELEE, HELICOPTER } PoliceType;
+#define AI_STATE_COUNT (DYING + 1)
+#define POLICE_TYPE_COUNT (HELICOPTER + 1)
 typedef enum { CAR, CONCRETE } BarrierType;
 typedef enum { START, PLAYING, PROTESTER_WIN, POLICE_WIN } GameState;
 
+// Self-contained PRNG (splitmix64) so a match seed reproduces the same
+// match on every platform, independent of the C library's rand().
+typedef struct {
+    uint64_t state;
+} Rng;
+
+// Per-entity state that the neighbour, target and hit scans never read.
+typedef struct {
+    EntityType type;
+    PoliceType police_type;
+    int bullet_health;
+    int melee_health;
+    float cooldown;
+    int target_id;
+    bool is_player_controlled;
+    float animation_timer;
+    int cover_slot;
+    Vector2 wander_target;
+    float wander_timer;
+    int lod_phase;          // tick, mod LOD_INTERVAL, of its reduced-rate updates
+    Rng rng;
+} EntityCold;
+
+// One team stored as structure-of-arrays. The fields every scan reads each
+// tick are kept in parallel arrays so a distance loop only streams the
+// coordinates and flags it needs; the rest lives in `cold`. Entities occupy
+// [0, count); the arrays grow on demand and dead entities are compacted out
+// at the end of each tick, so loops only visit what is alive.
+typedef struct {
+    int capacity;
+    int count;
+    float *pos_x;
+    float *pos_y;
+    float *vel_x;
+    float *vel_y;
+    bool *active;
+    AIState *ai_state;
+    bool *taking_cover;
+    EntityCold *cold;
+} EntityStore;
+
+typedef struct {
+    Vector2 pos;
+    Vector2 dir;
+    EntityType type;
+} Shot;
+
+// Side effects of one AI update that would touch shared state. During the
+// parallel AI phase they are queued here and applied in index order once
+// every update has finished.
+typedef struct {
+    Shot shots[MAX_SHOTS_PER_UPDATE];
+    int shot_count;
+    int melee_target;
+} AIEffects;
+
+// Unpacked working copy of one entity. The per-entity AI and player code
+// runs on one of these between load_entity and store_entity.
 typedef struct {
     Vector2 position;
     Vector2 velocity;
@@ -70,12 +185,14 @@ typedef struct {
     int target_id;
     bool is_player_controlled;
     float animation_timer;
-    float morale_boost;
+    float morale_boost;      // the team's, filled in by load_entity
     bool is_taking_cover;
-    int cover_barrier_id;
-    float morale_penalty_timer;
+    int cover_slot;
     Vector2 wander_target;
     float wander_timer;
+    int lod_phase;
+    Rng rng;
+    AIEffects *effects;     // set only while the parallel AI phase runs
 } Entity;
 
 typedef struct {
@@ -86,6 +203,30 @@ typedef struct {
     float distance_traveled;
 } Projectile;
 
+// What integrate_projectile worked out for a projectile this tick, for
+// resolve_projectiles to finish with.
+typedef struct {
+    Vector2 start;
+    float barrier_t;
+    bool blocked;
+    bool expired;
+} ProjectileStep;
+
+// Slot allocator for projectiles[]. Free slots sit in a min-heap and live
+// slots in a dense list (with each slot's position in it), so firing costs
+// O(log n) and expiring and iterating O(1) per projectile actually in flight.
+// Handing out the lowest free slot and resolving the live list in slot order
+// keep hits landing in the order a scan over every slot would give them.
+typedef struct {
+    int capacity;
+    int *free_slots;
+    int free_count;
+    int *live;
+    int *live_index;
+    int live_count;
+    int *merged;            // scratch for resolve_projectiles
+} ProjectilePool;
+
 typedef struct {
     Vector2 start;
     Vector2 end;
@@ -98,21 +239,374 @@ typedef struct {
     float territory_hold_timer;
     float protester_morale;
     float police_morale;
+    float protester_boost;  // speed factor from morale, shared by the team
+    float police_boost;
     float cover_cycle_timer;
     int last_police_count;
     float police_defeat_timer;
     int cover_cycle_phase;
+    long tick;
+    uint64_t seed;
+    Rng rng;
 } Game;
 
-Entity protesters[MAX_PROTESTERS] = {0};
-Entity police[MAX_POLICE] = {0};
-Projectile projectiles[MAX_PROJECTILES] = {0};
-Barrier barriers[MAX_BARRIERS] = {0};
+// Running totals per team, kept up to date wherever a unit spawns, dies,
+// changes AI state or moves, so morale, win checks and the HUD never have
+// to recount. AI updates run in parallel, hence the atomics; the sums do
+// not depend on the order the updates land in. Morale reads the counters
+// while cover and selection update them, which is safe because recount_unit
+// leaves untouched every counter a change does not affect.
+typedef struct {
+    atomic_int active;                          // dying units included
+    atomic_int state[AI_STATE_COUNT];           // active units by AI state
+    atomic_int fighting[POLICE_TYPE_COUNT];     // active, not dying, by police type
+    atomic_int in_territory;                    // protesters on the target line
+} TeamCounts;
+
+// The parts of a unit the counters look at.
+typedef struct {
+    bool active;
+    AIState state;
+    PoliceType police_type;
+    bool in_territory;
+} UnitTally;
+
+// Options that stay fixed for a whole match.
+typedef struct {
+    // Test the path each projectile covers during a step instead of only its
+    // end point, so hits no longer depend on the step length.
+    bool swept_projectiles;
+    // Units placed at match start. The police count includes the helicopter.
+    int protester_count;
+    int police_count;
+    int barrier_count;
+    // Initial projectile slots; the pool doubles when it runs out.
+    int projectile_capacity;
+    // Run the AI of units out of reach of every enemy only every
+    // LOD_INTERVAL ticks and let them coast in between. Off by default: on
+    // the standard field nearly every unit is within STONE_RANGE or
+    // BULLET_RANGE of an enemy, so it saves little.
+    bool ai_lod;
+} MatchConfig;
+
+// Player input for one simulation step. The window build fills it from
+// raylib every frame; headless runs pass whatever they want to inject.
+typedef struct {
+    bool move_up;
+    bool move_down;
+    bool move_left;
+    bool move_right;
+    bool fire;
+    bool select;
+    Vector2 mouse_pos;
+} PlayerInput;
+
+// A recorded match: the seed and match options, then one record per tick
+// whose input differs from "same keys held as last tick, no clicks". A
+// record is a varint tick delta, a flags byte and, for clicks, the mouse
+// position as zigzag varint deltas from the previous click. The file ends
+// with REPLAY_END, the tick count and the final checksum.
+#define REPLAY_MAGIC "PRPL"
+#define REPLAY_VERSION 2
+#define REPLAY_FIRE 0x10
+#define REPLAY_SELECT 0x20
+#define REPLAY_END 0x80
+
+// Whole-match snapshot. The header carries the scalar state and where each
+// array starts; the arrays follow as raw memory, each aligned to
+// SNAPSHOT_ALIGN, so a loader can map the file and copy them straight out.
+// The struct sizes guard against reading a file from a different build.
+#define SNAPSHOT_MAGIC "PRSN"
+#define SNAPSHOT_VERSION 5
+#define SNAPSHOT_ARRAYS 21
+#define SNAPSHOT_ALIGN 64
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t struct_sizes[5];
+    MatchConfig config;
+    Game game;
+    int selected_entity;
+    int selected_type;
+    int protester_count;
+    int police_count;
+    int projectile_capacity;
+    int projectile_free_count;
+    int projectile_live_count;
+    int barrier_count;
+    uint64_t offsets[SNAPSHOT_ARRAYS];
+    uint64_t sizes[SNAPSHOT_ARRAYS];
+} SnapshotHeader;
+
+typedef struct {
+    FILE *file;
+    long tick;            // ticks recorded or played back so far
+    long record_tick;     // tick of the last record written, or of the next one to play
+    int flags;            // flags of that record
+    int keys;             // movement keys held since the last record
+    int mouse_x;
+    int mouse_y;
+    long end_tick;        // playback: length of the recording
+    uint64_t checksum;    // playback: state checksum it ended with
+} Replay;
+
+// Match aggregates after one tick, one CSV row of the telemetry stream.
+// Team arrays are indexed by EntityType.
+typedef struct {
+    long tick;
+    int active[2];
+    int states[2][AI_STATE_COUNT];
+    float morale[2];
+    float territory_hold_timer;
+    int projectiles;
+    float tick_ms;
+} TelemetrySample;
+
+// Streams TelemetrySamples to a file from a writer thread. The game thread
+// is the only producer and the writer the only consumer of the ring, so head
+// and tail need no lock; when the writer falls a whole ring behind, samples
+// are dropped rather than making the game wait.
+typedef struct {
+    FILE *file;
+    pthread_t writer;
+    TelemetrySample ring[TELEMETRY_RING_SIZE];
+    atomic_ulong head;      // next slot the game fills
+    atomic_ulong tail;      // next slot the writer prints
+    atomic_bool stop;
+    long dropped;
+} Telemetry;
+
+typedef void (*RangeJob)(void *ctx, int begin, int end);
+
+// What the tasks of one update_game call share.
+typedef struct {
+    float dt;
+    const PlayerInput *input;
+    int projectiles_in_flight;
+} TickContext;
+
+// One phase of a tick: job runs over [0, count), split into ranges of at
+// least `chunk` items. A task becomes ready once every task it waits on has
+// finished; tasks may only wait on tasks added before them.
+typedef struct {
+    RangeJob job;
+    void *ctx;
+    int count;
+    int chunk;
+    int successors[MAX_TASK_SUCCESSORS];
+    int successor_count;
+    int dependency_count;
+    atomic_int waiting;
+    atomic_int remaining;
+} Task;
+
+typedef struct {
+    Task tasks[MAX_TASKS];
+    int task_count;
+    atomic_int unfinished;
+} TaskGraph;
+
+typedef struct {
+    Task *task;
+    int begin;
+    int end;
+} Job;
+
+// Per-thread deque. The owner pushes and pops at the bottom; idle threads
+// steal from the top, where the largest unsplit ranges sit.
+typedef struct {
+    pthread_mutex_t lock;
+    Job jobs[WORK_QUEUE_SIZE];
+    unsigned top;
+    unsigned bottom;
+} WorkQueue;
+
+// Work-stealing scheduler. The thread calling run_graph is thread 0 and
+// works alongside worker_count persistent workers.
+typedef struct {
+    pthread_t workers[MAX_THREADS];
+    int worker_count;
+    WorkQueue queues[MAX_THREADS];
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    unsigned generation;
+    int busy;
+    bool quit;
+    TaskGraph *graph;
+} ThreadPool;
+
+// Uniform grid over one team, rebuilt once per tick. Entities of cell c are
+// entries[cell_start[c] .. cell_start[c + 1]).
+typedef struct {
+    int cell_start[GRID_CELLS + 1];
+    int *entries;
+    int entry_capacity;
+} SpatialGrid;
+
+// Barriers bucketed by the grid cells their reach overlaps, so any point
+// within BARRIER_REACH of a barrier finds it in the point's own cell. Each
+// cell lists barriers in index order. Barriers never move or fall during a
+// match, so init_game builds this once.
+typedef struct {
+    int cell_start[GRID_CELLS + 1];
+    int *entries;
+    int entry_capacity;
+} BarrierGrid;
+
+typedef bool (*BarrierVisit)(void *ctx, int barrier);
+
+// Places to take cover: COVER_SLOTS_PER_BARRIER spots spread along the east
+// face of every active barrier, just clear of it. Only protesters east of a
+// barrier may shelter behind it, so the west face gets none. Slots are bucketed into the unit
+// grid by position, slots of cell c being entries[cell_start[c] ..
+// cell_start[c + 1]). reserved marks the slots handed out in the current
+// cover cycle. Rebuilt with the barrier grid.
+typedef struct {
+    Vector2 *pos;
+    int *barrier;
+    bool *reserved;
+    int count;
+    int capacity;
+    int cell_start[GRID_CELLS + 1];
+    int *entries;
+} CoverSlots;
+
+// Shortest-path field toward the protesters' territory line over
+// FLOW_CELL_SIZE cells, routed around barriers. cost is the path length in
+// cells (0 on the line, INFINITY where blocked or cut off) and dir the unit
+// step to the next cell on the path. Rebuilt with the barrier grid.
+typedef struct {
+    float cost[FLOW_CELLS];
+    Vector2 dir[FLOW_CELLS];
+} FlowField;
+
+typedef struct {
+    float cost;
+    int cell;
+} FlowNode;
+
+// Per-team density field for find_densest_enemy_area. Living entities are
+// binned and the per-bin count and position sums are kept as summed-area
+// tables, so bins lying fully inside DENSITY_RADIUS are added in O(1) per row
+// and only the rim bins need exact distance checks. The densest cluster does
+// not depend on the caller, so it is evaluated once and cached until the team
+// moves or loses a member.
+typedef struct {
+    int count_sat[DENSITY_SAT_SIZE];
+    double sum_x_sat[DENSITY_SAT_SIZE];
+    double sum_y_sat[DENSITY_SAT_SIZE];
+    int bin_start[DENSITY_BINS + 1];
+    int *entries;
+    int *outside;
+    int *members;     // scratch for density_exact_center
+    float *scores;    // per-member scores from the tables
+    int entry_capacity;
+    int outside_count;
+    bool valid;
+    bool found;
+    Vector2 center;
+} DensityMap;
+
+// Grid cells from which no enemy can be within the team's own weapon reach,
+// rebuilt each tick from the enemy grid. Reach is STONE_RANGE for the
+// protesters and BULLET_RANGE for the police.
+typedef struct {
+    bool far[GRID_CELLS];
+} LodMap;
+
+// Nearest-candidate query over one store. The score is the distance from
+// `from`, scaled up for targets further west when low_x_bias is set, and only scores
+// strictly below `limit` count. Ties go to the lowest index.
+typedef struct {
+    const EntityStore *store;
+    Vector2 from;
+    float limit;
+    bool skip_dying;
+    bool skip_cover;
+    bool low_x_bias;
+} NearestQuery;
+
+typedef int (*NearestKernel)(const NearestQuery *query, float *score);
+
+// Timed stages of a tick and of a frame.
+typedef enum {
+    PHASE_MORALE, PHASE_COVER, PHASE_SELECTION, PHASE_GRIDS, PHASE_PROTESTER_AI, PHASE_POLICE_AI,
+    PHASE_COMMIT, PHASE_PROJECTILES, PHASE_CONDITIONS, PHASE_COMPACT,
+    PHASE_DRAW_STATIC, PHASE_DRAW_ENTITIES, PHASE_DRAW_PROJECTILES, PHASE_DRAW_UI,
+    PHASE_COUNT
+} Phase;
+
+#define PROFILE_HISTORY 240
+
+// Phase timings, collected only while enabled. Stages add to pending as
+// they finish, possibly from several threads, and profile_frame moves the
+// totals into a ring of the last PROFILE_HISTORY frames.
+typedef struct {
+    bool enabled;
+    atomic_llong pending[PHASE_COUNT];              // ns so far this frame
+    float history[PHASE_COUNT][PROFILE_HISTORY];    // ms per frame
+    int frames;
+    int next;
+} Profiler;
+
+EntityStore protesters = {0};
+EntityStore police = {0};
+EntityStore protesters_next = {0};
+EntityStore police_next = {0};
+AIEffects *protester_effects = NULL;
+AIEffects *police_effects = NULL;
+int *protester_remap = NULL;
+int *police_remap = NULL;
+Projectile *projectiles = NULL;
+ProjectilePool projectile_pool = {0};
+ProjectileStep *projectile_steps = NULL;
+Barrier *barriers = NULL;
+int barrier_count = 0;
+int barrier_capacity = 0;
+int barrier_version = 0;  // bumped whenever the barrier layout is rebuilt
 Game game = {0};
+MatchConfig config = {.swept_projectiles = true, .protester_count = 80, .police_count = 60,
+                      .barrier_count = 12, .projectile_capacity = 1000};
+SpatialGrid protester_grid = {0};
+SpatialGrid police_grid = {0};
+BarrierGrid barrier_grid = {0};
+FlowField flow_field;
+CoverSlots cover_slots = {0};
+int *cover_candidates = NULL;
+DensityMap protester_density = {0};
+DensityMap police_density = {0};
+LodMap protester_lod = {0};
+LodMap police_lod = {0};
+TeamCounts protester_counts = {0};
+TeamCounts police_counts = {0};
+ThreadPool thread_pool = {.lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER,
+                          .done = PTHREAD_COND_INITIALIZER};
+TaskGraph tick_graph = {0};
+Profiler profiler = {0};
+Telemetry telemetry = {0};
 
 int selected_entity = -1;
 EntityType selected_type = PROTESTER;
 
+uint64_t rng_next(Rng *rng) {
+    uint64_t z = (rng->state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Uniform integer in [0, n).
+int rng_int(Rng *rng, int n) {
+    return (int)(rng_next(rng) % (uint64_t)n);
+}
+
+// Uniform float in [0, 1).
+float rng_float(Rng *rng) {
+    return (float)(rng_next(rng) >> 40) / (float)(1 << 24);
+}
+
 float distance(Vector2 p1, Vector2 p2) {
     return sqrtf((p1.x - p2.x) * (p1.x - p2.x) + (p1.y - p2.y) * (p1.y - p2.y));
 }
@@ -128,27 +622,497 @@ bool point_near_line(Vector2 point, Vector2 line_start, Vector2 line_end, float
     return distance(point, projection) < threshold;
 }
 
-bool has_clear_shot(Vector2 start, Vector2 target) {
-    for (int i = 0; i < MAX_BARRIERS; i++) {
-        if (barriers[i].active) {
-            Vector2 barrier_center = {barriers[i].start.x, 
-                                     (barriers[i].start.y + barriers[i].end.y) / 2};
-            if (target.x > start.x && barrier_center.x > start.x && barrier_center.x < target.x) {
-                float t = (barriers[i].start.x - start.x) / (target.x - start.x);
-                if (t >= 0 && t <= 1) {
-                    float y_intersect = start.y + t * (target.y - start.y);
-                    if (y_intersect >= barriers[i].start.y - COVER_WIDTH / 2 &&
-                        y_intersect <= barriers[i].end.y + COVER_WIDTH / 2) {
-                        return false;
-                    }
-                }
+// realloc that gives up on the match when memory runs out.
+void *resize_array(void *array, int count, size_t size) {
+    void *resized = realloc(array, (size_t)count * size);
+    if (!resized && count > 0) {
+        fprintf(stderr, "out of memory allocating %d items\n", count);
+        exit(1);
+    }
+    return resized;
+}
+
+// Grows the store's arrays to hold `capacity` entities.
+void reserve_store(EntityStore *store, int capacity) {
+    if (capacity <= store->capacity) return;
+    store->pos_x = resize_array(store->pos_x, capacity, sizeof(float));
+    store->pos_y = resize_array(store->pos_y, capacity, sizeof(float));
+    store->vel_x = resize_array(store->vel_x, capacity, sizeof(float));
+    store->vel_y = resize_array(store->vel_y, capacity, sizeof(float));
+    store->active = resize_array(store->active, capacity, sizeof(bool));
+    store->ai_state = resize_array(store->ai_state, capacity, sizeof(AIState));
+    store->taking_cover = resize_array(store->taking_cover, capacity, sizeof(bool));
+    store->cold = resize_array(store->cold, capacity, sizeof(EntityCold));
+    store->capacity = capacity;
+}
+
+Vector2 store_position(const EntityStore *store, int i) {
+    return (Vector2){store->pos_x[i], store->pos_y[i]};
+}
+
+Vector2 store_velocity(const EntityStore *store, int i) {
+    return (Vector2){store->vel_x[i], store->vel_y[i]};
+}
+
+void load_entity(const EntityStore *store, int i, Entity *entity) {
+    const EntityCold *cold = &store->cold[i];
+    entity->position = store_position(store, i);
+    entity->velocity = store_velocity(store, i);
+    entity->active = store->active[i];
+    entity->ai_state = store->ai_state[i];
+    entity->is_taking_cover = store->taking_cover[i];
+    entity->type = cold->type;
+    entity->police_type = cold->police_type;
+    entity->bullet_health = cold->bullet_health;
+    entity->melee_health = cold->melee_health;
+    entity->cooldown = cold->cooldown;
+    entity->target_id = cold->target_id;
+    entity->is_player_controlled = cold->is_player_controlled;
+    entity->animation_timer = cold->animation_timer;
+    entity->morale_boost = cold->type == PROTESTER ? game.protester_boost : game.police_boost;
+    entity->cover_slot = cold->cover_slot;
+    entity->wander_target = cold->wander_target;
+    entity->wander_timer = cold->wander_timer;
+    entity->lod_phase = cold->lod_phase;
+    entity->rng = cold->rng;
+    entity->effects = NULL;
+}
+
+void store_entity(EntityStore *store, int i, const Entity *entity) {
+    EntityCold *cold = &store->cold[i];
+    store->pos_x[i] = entity->position.x;
+    store->pos_y[i] = entity->position.y;
+    store->vel_x[i] = entity->velocity.x;
+    store->vel_y[i] = entity->velocity.y;
+    store->active[i] = entity->active;
+    store->ai_state[i] = entity->ai_state;
+    store->taking_cover[i] = entity->is_taking_cover;
+    cold->type = entity->type;
+    cold->police_type = entity->police_type;
+    cold->bullet_health = entity->bullet_health;
+    cold->melee_health = entity->melee_health;
+    cold->cooldown = entity->cooldown;
+    cold->target_id = entity->target_id;
+    cold->is_player_controlled = entity->is_player_controlled;
+    cold->animation_timer = entity->animation_timer;
+    cold->cover_slot = entity->cover_slot;
+    cold->wander_target = entity->wander_target;
+    cold->wander_timer = entity->wander_timer;
+    cold->lod_phase = entity->lod_phase;
+    cold->rng = entity->rng;
+}
+
+// Nearest-candidate scans. The scalar scan is the reference; the SIMD
+// kernels below must return the same index and score bit for bit.
+float distance_sq(Vector2 p1, Vector2 p2) {
+    return (p1.x - p2.x) * (p1.x - p2.x) + (p1.y - p2.y) * (p1.y - p2.y);
+}
+
+bool nearest_candidate(const NearestQuery *query, int i) {
+    const EntityStore *store = query->store;
+    return store->active[i] && !(query->skip_dying && store->ai_state[i] == DYING) &&
+           !(query->skip_cover && store->taking_cover[i]);
+}
+
+float nearest_score(const NearestQuery *query, int i) {
+    Vector2 pos = store_position(query->store, i);
+    float score = distance(query->from, pos);
+    if (query->low_x_bias) {
+        score *= (1.0f + 0.5f * (SCREEN_WIDTH - pos.x) / SCREEN_WIDTH);
+    }
+    return score;
+}
+
+// Continues a scan over [first, last) from the current best.
+int nearest_scan(const NearestQuery *query, int first, int last, int best, float *score) {
+    for (int i = first; i < last; i++) {
+        if (nearest_candidate(query, i)) {
+            float s = nearest_score(query, i);
+            if (s < *score) {
+                *score = s;
+                best = i;
             }
         }
     }
-    return true;
+    return best;
+}
+
+int nearest_scalar(const NearestQuery *query, float *score) {
+    *score = query->limit;
+    return nearest_scan(query, 0, query->store->count, -1, score);
+}
+
+// Merges per-lane winners of a scored kernel, which already hold exact
+// scores, then finishes the tail past `done` one candidate at a time.
+int nearest_lanes_finish(const NearestQuery *query, const float *lane_score, const int32_t *lane_index,
+                         int lanes, int done, float *score) {
+    int best = -1;
+    *score = query->limit;
+    for (int l = 0; l < lanes; l++) {
+        if (lane_index[l] < 0) continue;
+        if (lane_score[l] < *score || (lane_score[l] == *score && lane_index[l] < best)) {
+            *score = lane_score[l];
+            best = lane_index[l];
+        }
+    }
+    return nearest_scan(query, done, query->store->count, best, score);
+}
+
+// Merges per-lane winners of a squared-distance kernel. Distinct squared
+// distances can round to the same sqrtf, and the scalar loop then keeps the
+// earlier index, so when some lane might hold such a near-tie (its smallest
+// or second smallest value is within rounding of the winner) the candidates
+// before the winner are rechecked against the largest squared distance with
+// the winning root.
+int nearest_squared_finish(const NearestQuery *query, const float *lane_min, const float *lane_next,
+                           const int32_t *lane_index, int lanes, int done, float *score) {
+    int best = -1;
+    float best_sq = INFINITY;
+    for (int l = 0; l < lanes; l++) {
+        if (lane_index[l] < 0) continue;
+        if (lane_min[l] < best_sq || (lane_min[l] == best_sq && lane_index[l] < best)) {
+            best_sq = lane_min[l];
+            best = lane_index[l];
+        }
+    }
+    *score = query->limit;
+    if (best >= 0) {
+        // Squared distances sharing a root lie within a relative 2^-21 of
+        // each other, so the exact bound is only needed past this check.
+        float root = sqrtf(best_sq);
+        float tie_sq = best_sq + best_sq * 0x1p-20f;
+        bool near_tie = false;
+        for (int l = 0; l < lanes; l++) {
+            if (lane_index[l] < 0) continue;
+            if ((lane_min[l] > best_sq && lane_min[l] <= tie_sq) || (lane_min[l] == best_sq && lane_next[l] <= tie_sq)) {
+                near_tie = true;
+            }
+        }
+        if (near_tie) {
+            tie_sq = best_sq;
+            while (sqrtf(nextafterf(tie_sq, INFINITY)) == root) tie_sq = nextafterf(tie_sq, INFINITY);
+        }
+        for (int i = 0; near_tie && i < best; i++) {
+            if (nearest_candidate(query, i) && distance_sq(query->from, store_position(query->store, i)) <= tie_sq) {
+                best = i;
+            }
+        }
+        if (root < query->limit) {
+            *score = root;
+        } else {
+            best = -1;
+        }
+    }
+    return nearest_scan(query, done, query->store->count, best, score);
+}
+
+#ifdef SIMD_SCANS
+_Static_assert(sizeof(AIState) == sizeof(int32_t), "SIMD scans load ai_state as 32-bit lanes");
+
+// Widens four bool flags to all-ones or all-zero 32-bit lanes.
+__attribute__((target("sse2")))
+__m128i flags_sse2(const bool *flags) {
+    int32_t bytes;
+    memcpy(&bytes, flags, sizeof(bytes));
+    __m128i zero = _mm_setzero_si128();
+    __m128i wide = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), zero);
+    return _mm_cmpgt_epi32(wide, zero);
+}
+
+__attribute__((target("sse2")))
+__m128 candidates_sse2(const NearestQuery *query, int i) {
+    const EntityStore *store = query->store;
+    __m128i mask = flags_sse2(&store->active[i]);
+    if (query->skip_dying) {
+        __m128i dying = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)&store->ai_state[i]), _mm_set1_epi32(DYING));
+        mask = _mm_andnot_si128(dying, mask);
+    }
+    if (query->skip_cover) mask = _mm_andnot_si128(flags_sse2(&store->taking_cover[i]), mask);
+    return _mm_castsi128_ps(mask);
+}
+
+__attribute__((target("sse2")))
+int nearest_squared_sse2(const NearestQuery *query, float *score) {
+    const EntityStore *store = query->store;
+    int done = store->count & ~3;
+    __m128 from_x = _mm_set1_ps(query->from.x), from_y = _mm_set1_ps(query->from.y);
+    __m128 inf = _mm_set1_ps(INFINITY), best = inf, next = inf;
+    __m128i index = _mm_setr_epi32(0, 1, 2, 3), best_index = _mm_set1_epi32(-1);
+    for (int i = 0; i < done; i += 4) {
+        __m128 dx = _mm_sub_ps(from_x, _mm_loadu_ps(&store->pos_x[i]));
+        __m128 dy = _mm_sub_ps(from_y, _mm_loadu_ps(&store->pos_y[i]));
+        __m128 sq = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+        __m128 mask = candidates_sse2(query, i);
+        sq = _mm_or_ps(_mm_and_ps(mask, sq), _mm_andnot_ps(mask, inf));
+        __m128i lower = _mm_castps_si128(_mm_cmplt_ps(sq, best));
+        next = _mm_min_ps(next, _mm_max_ps(best, sq));
+        best = _mm_min_ps(best, sq);
+        best_index = _mm_or_si128(_mm_and_si128(lower, index), _mm_andnot_si128(lower, best_index));
+        index = _mm_add_epi32(index, _mm_set1_epi32(4));
+    }
+    float lane_min[4], lane_next[4];
+    int32_t lane_index[4];
+    _mm_storeu_ps(lane_min, best);
+    _mm_storeu_ps(lane_next, next);
+    _mm_storeu_si128((__m128i *)lane_index, best_index);
+    return nearest_squared_finish(query, lane_min, lane_next, lane_index, 4, done, score);
+}
+
+// The west bias is evaluated in the same operation order as nearest_score.
+__attribute__((target("sse2")))
+int nearest_scored_sse2(const NearestQuery *query, float *score) {
+    const EntityStore *store = query->store;
+    int done = store->count & ~3;
+    __m128 from_x = _mm_set1_ps(query->from.x), from_y = _mm_set1_ps(query->from.y);
+    __m128 width = _mm_set1_ps((float)SCREEN_WIDTH), half = _mm_set1_ps(0.5f), one = _mm_set1_ps(1.0f);
+    __m128 best = _mm_set1_ps(query->limit);
+    __m128i index = _mm_setr_epi32(0, 1, 2, 3), best_index = _mm_set1_epi32(-1);
+    for (int i = 0; i < done; i += 4) {
+        __m128 x = _mm_loadu_ps(&store->pos_x[i]);
+        __m128 dx = _mm_sub_ps(from_x, x);
+        __m128 dy = _mm_sub_ps(from_y, _mm_loadu_ps(&store->pos_y[i]));
+        __m128 s = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+        if (query->low_x_bias) {
+            s = _mm_mul_ps(s, _mm_add_ps(one, _mm_div_ps(_mm_mul_ps(half, _mm_sub_ps(width, x)), width)));
+        }
+        __m128 lower_ps = _mm_and_ps(candidates_sse2(query, i), _mm_cmplt_ps(s, best));
+        __m128i lower = _mm_castps_si128(lower_ps);
+        best = _mm_or_ps(_mm_and_ps(lower_ps, s), _mm_andnot_ps(lower_ps, best));
+        best_index = _mm_or_si128(_mm_and_si128(lower, index), _mm_andnot_si128(lower, best_index));
+        index = _mm_add_epi32(index, _mm_set1_epi32(4));
+    }
+    float lane_score[4];
+    int32_t lane_index[4];
+    _mm_storeu_ps(lane_score, best);
+    _mm_storeu_si128((__m128i *)lane_index, best_index);
+    return nearest_lanes_finish(query, lane_score, lane_index, 4, done, score);
+}
+
+__attribute__((target("avx2")))
+__m256i flags_avx2(const bool *flags) {
+    __m256i wide = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)flags));
+    return _mm256_cmpgt_epi32(wide, _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2")))
+__m256 candidates_avx2(const NearestQuery *query, int i) {
+    const EntityStore *store = query->store;
+    __m256i mask = flags_avx2(&store->active[i]);
+    if (query->skip_dying) {
+        __m256i dying = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *)&store->ai_state[i]), _mm256_set1_epi32(DYING));
+        mask = _mm256_andnot_si256(dying, mask);
+    }
+    if (query->skip_cover) mask = _mm256_andnot_si256(flags_avx2(&store->taking_cover[i]), mask);
+    return _mm256_castsi256_ps(mask);
+}
+
+__attribute__((target("avx2")))
+int nearest_squared_avx2(const NearestQuery *query, float *score) {
+    const EntityStore *store = query->store;
+    int done = store->count & ~7;
+    __m256 from_x = _mm256_set1_ps(query->from.x), from_y = _mm256_set1_ps(query->from.y);
+    __m256 inf = _mm256_set1_ps(INFINITY), best = inf, next = inf;
+    __m256 index = _mm256_castsi256_ps(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    __m256 best_index = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    for (int i = 0; i < done; i += 8) {
+        __m256 dx = _mm256_sub_ps(from_x, _mm256_loadu_ps(&store->pos_x[i]));
+        __m256 dy = _mm256_sub_ps(from_y, _mm256_loadu_ps(&store->pos_y[i]));
+        __m256 sq = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+        sq = _mm256_blendv_ps(inf, sq, candidates_avx2(query, i));
+        __m256 lower = _mm256_cmp_ps(sq, best, _CMP_LT_OQ);
+        next = _mm256_min_ps(next, _mm256_max_ps(best, sq));
+        best = _mm256_min_ps(best, sq);
+        best_index = _mm256_blendv_ps(best_index, index, lower);
+        index = _mm256_castsi256_ps(_mm256_add_epi32(_mm256_castps_si256(index), _mm256_set1_epi32(8)));
+    }
+    float lane_min[8], lane_next[8];
+    int32_t lane_index[8];
+    _mm256_storeu_ps(lane_min, best);
+    _mm256_storeu_ps(lane_next, next);
+    _mm256_storeu_si256((__m256i *)lane_index, _mm256_castps_si256(best_index));
+    return nearest_squared_finish(query, lane_min, lane_next, lane_index, 8, done, score);
+}
+
+__attribute__((target("avx2")))
+int nearest_scored_avx2(const NearestQuery *query, float *score) {
+    const EntityStore *store = query->store;
+    int done = store->count & ~7;
+    __m256 from_x = _mm256_set1_ps(query->from.x), from_y = _mm256_set1_ps(query->from.y);
+    __m256 width = _mm256_set1_ps((float)SCREEN_WIDTH), half = _mm256_set1_ps(0.5f), one = _mm256_set1_ps(1.0f);
+    __m256 best = _mm256_set1_ps(query->limit);
+    __m256 index = _mm256_castsi256_ps(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    __m256 best_index = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    for (int i = 0; i < done; i += 8) {
+        __m256 x = _mm256_loadu_ps(&store->pos_x[i]);
+        __m256 dx = _mm256_sub_ps(from_x, x);
+        __m256 dy = _mm256_sub_ps(from_y, _mm256_loadu_ps(&store->pos_y[i]));
+        __m256 s = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)));
+        if (query->low_x_bias) {
+            s = _mm256_mul_ps(s, _mm256_add_ps(one, _mm256_div_ps(_mm256_mul_ps(half, _mm256_sub_ps(width, x)), width)));
+        }
+        __m256 lower = _mm256_and_ps(candidates_avx2(query, i), _mm256_cmp_ps(s, best, _CMP_LT_OQ));
+        best = _mm256_blendv_ps(best, s, lower);
+        best_index = _mm256_blendv_ps(best_index, index, lower);
+        index = _mm256_castsi256_ps(_mm256_add_epi32(_mm256_castps_si256(index), _mm256_set1_epi32(8)));
+    }
+    float lane_score[8];
+    int32_t lane_index[8];
+    _mm256_storeu_ps(lane_score, best);
+    _mm256_storeu_si256((__m256i *)lane_index, _mm256_castps_si256(best_index));
+    return nearest_lanes_finish(query, lane_score, lane_index, 8, done, score);
+}
+#endif
+
+// Plain distances are compared squared; the west-biased score is not a
+// function of squared distance alone, so those scans score every lane.
+NearestKernel nearest_squared_kernel = nearest_scalar;
+NearestKernel nearest_scored_kernel = nearest_scalar;
+
+void select_scan_kernels() {
+#ifdef SIMD_SCANS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        nearest_squared_kernel = nearest_squared_avx2;
+        nearest_scored_kernel = nearest_scored_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        nearest_squared_kernel = nearest_squared_sse2;
+        nearest_scored_kernel = nearest_scored_sse2;
+    }
+#endif
+}
+
+int find_nearest(const NearestQuery *query, float *score) {
+    return query->low_x_bias ? nearest_scored_kernel(query, score) : nearest_squared_kernel(query, score);
+}
+
+EntityStore *team_store(EntityType type) {
+    return type == PROTESTER ? &protesters : &police;
+}
+
+TeamCounts *team_counts(EntityType type) {
+    return type == PROTESTER ? &protester_counts : &police_counts;
+}
+
+void reset_team_counts(TeamCounts *counts) {
+    atomic_store(&counts->active, 0);
+    for (int s = 0; s < AI_STATE_COUNT; s++) atomic_store(&counts->state[s], 0);
+    for (int t = 0; t < POLICE_TYPE_COUNT; t++) atomic_store(&counts->fighting[t], 0);
+    atomic_store(&counts->in_territory, 0);
+}
+
+bool in_protester_territory(EntityType type, Vector2 pos) {
+    return type == PROTESTER && distance(pos, (Vector2){PROTESTER_TERRITORY_X, pos.y}) < TERRITORY_RANGE;
+}
+
+UnitTally entity_tally(const Entity *entity) {
+    return (UnitTally){entity->active, entity->ai_state, entity->police_type,
+                       entity->active && in_protester_territory(entity->type, entity->position)};
+}
+
+UnitTally store_tally(const EntityStore *store, int i) {
+    return (UnitTally){store->active[i], store->ai_state[i], store->cold[i].police_type,
+                       store->active[i] && in_protester_territory(store->cold[i].type, store_position(store, i))};
+}
+
+void count_unit(TeamCounts *counts, UnitTally unit, int delta) {
+    if (!unit.active) return;
+    atomic_fetch_add_explicit(&counts->active, delta, memory_order_relaxed);
+    atomic_fetch_add_explicit(&counts->state[unit.state], delta, memory_order_relaxed);
+    if (unit.state != DYING) atomic_fetch_add_explicit(&counts->fighting[unit.police_type], delta, memory_order_relaxed);
+    if (unit.in_territory) atomic_fetch_add_explicit(&counts->in_territory, delta, memory_order_relaxed);
+}
+
+// Adds delta to one counter, skipping the atomic when there is nothing to add.
+void add_count(atomic_int *count, int delta) {
+    if (delta != 0) atomic_fetch_add_explicit(count, delta, memory_order_relaxed);
+}
+
+// Applies only the net change of each counter, so a concurrent reader never
+// sees a counter the unit leaves unchanged move, e.g. `active` dipping while
+// a unit merely switches AI state.
+void recount_unit(TeamCounts *counts, UnitTally was, UnitTally now) {
+    if (was.active == now.active && was.state == now.state && was.in_territory == now.in_territory) return;
+    int was_in = was.active, now_in = now.active;
+    add_count(&counts->active, now_in - was_in);
+    if (was.state == now.state) {
+        add_count(&counts->state[now.state], now_in - was_in);
+    } else {
+        add_count(&counts->state[was.state], -was_in);
+        add_count(&counts->state[now.state], now_in);
+    }
+    int was_fighting = was_in && was.state != DYING, now_fighting = now_in && now.state != DYING;
+    if (was.police_type == now.police_type) {
+        add_count(&counts->fighting[now.police_type], now_fighting - was_fighting);
+    } else {
+        add_count(&counts->fighting[was.police_type], -was_fighting);
+        add_count(&counts->fighting[now.police_type], now_fighting);
+    }
+    add_count(&counts->in_territory, (now_in && now.in_territory) - (was_in && was.in_territory));
+}
+
+// Active units that are not dying.
+int fighting_units(const TeamCounts *counts) {
+    return atomic_load(&counts->active) - atomic_load(&counts->state[DYING]);
+}
+
+// Grows a team's store together with its next-tick buffer, AI effects and
+// compaction map.
+void reserve_team(EntityType type, int capacity) {
+    if (capacity < MIN_STORE_CAPACITY) capacity = MIN_STORE_CAPACITY;
+    if (capacity <= team_store(type)->capacity) return;
+    if (type == PROTESTER) {
+        reserve_store(&protesters, capacity);
+        reserve_store(&protesters_next, capacity);
+        protester_effects = resize_array(protester_effects, capacity, sizeof(AIEffects));
+        protester_remap = resize_array(protester_remap, capacity, sizeof(int));
+    } else {
+        reserve_store(&police, capacity);
+        reserve_store(&police_next, capacity);
+        police_effects = resize_array(police_effects, capacity, sizeof(AIEffects));
+        police_remap = resize_array(police_remap, capacity, sizeof(int));
+    }
+}
+
+// Appends a slot to the team, doubling its storage when full.
+int add_entity(EntityType type) {
+    EntityStore *store = team_store(type);
+    if (store->count == store->capacity) reserve_team(type, store->capacity * 2);
+    return store->count++;
 }
 
-void init_entity(Entity *entity, Vector2 pos, EntityType type, PoliceType police_type) {
+// Moves entity `from` into slot `to` of the same store.
+void move_entity(EntityStore *store, int from, int to) {
+    store->pos_x[to] = store->pos_x[from];
+    store->pos_y[to] = store->pos_y[from];
+    store->vel_x[to] = store->vel_x[from];
+    store->vel_y[to] = store->vel_y[from];
+    store->active[to] = store->active[from];
+    store->ai_state[to] = store->ai_state[from];
+    store->taking_cover[to] = store->taking_cover[from];
+    store->cold[to] = store->cold[from];
+}
+
+// Drops inactive entities and keeps the rest in order, so every index-order
+// rule still picks the same unit. remap receives each old slot's new index,
+// or -1. Returns whether anything moved.
+bool compact_store(EntityStore *store, int *remap) {
+    int kept = 0;
+    for (int i = 0; i < store->count; i++) {
+        if (!store->active[i]) {
+            remap[i] = -1;
+            continue;
+        }
+        if (kept != i) move_entity(store, i, kept);
+        remap[i] = kept++;
+    }
+    bool moved = kept != store->count;
+    store->count = kept;
+    return moved;
+}
+
+void init_entity(EntityStore *store, int index, Vector2 pos, EntityType type, PoliceType police_type) {
+    Entity e;
+    Entity *entity = &e;
     entity->position = pos;
     entity->velocity = (Vector2){0, 0};
     entity->type = type;
@@ -167,10 +1131,16 @@ void init_entity(Entity *entity, Vector2 pos, EntityType type, PoliceType police
     entity->animation_timer = 0;
     entity->morale_boost = 1.0f;
     entity->is_taking_cover = false;
-    entity->cover_barrier_id = -1;
-    entity->morale_penalty_timer = 0.0f;
+    entity->cover_slot = -1;
     entity->wander_target = (Vector2){0, 0};
     entity->wander_timer = 0.0f;
+    entity->lod_phase = index % LOD_INTERVAL;
+    // Each entity draws from its own stream so AI updates can run in any
+    // order without changing what they roll.
+    Rng stream = {game.seed ^ ((uint64_t)type << 32 | (uint64_t)index)};
+    entity->rng.state = rng_next(&stream);
+    store_entity(store, index, entity);
+    count_unit(team_counts(type), entity_tally(entity), 1);
 }
 
 void init_barrier(Barrier *barrier, Vector2 pos, BarrierType type) {
@@ -182,133 +1152,553 @@ void init_barrier(Barrier *barrier, Vector2 pos, BarrierType type) {
     barrier->active = true;
 }
 
-void init_game() {
-    srand((unsigned int)time(NULL));
+void spawn_entity(Vector2 pos, EntityType type, PoliceType police_type) {
+    int index = add_entity(type);
+    init_entity(team_store(type), index, pos, type, police_type);
+}
+
+int add_barrier() {
+    if (barrier_count == barrier_capacity) {
+        barrier_capacity = barrier_capacity > 0 ? barrier_capacity * 2 : 16;
+        barriers = resize_array(barriers, barrier_capacity, sizeof(Barrier));
+    }
+    return barrier_count++;
+}
+
+// Grows the projectile pool. It only grows once every slot is taken, and
+// the new slots in ascending order already form a valid heap.
+void reserve_projectiles(int capacity) {
+    ProjectilePool *pool = &projectile_pool;
+    if (capacity < MIN_STORE_CAPACITY) capacity = MIN_STORE_CAPACITY;
+    if (capacity <= pool->capacity) return;
+    projectiles = resize_array(projectiles, capacity, sizeof(Projectile));
+    projectile_steps = resize_array(projectile_steps, capacity, sizeof(ProjectileStep));
+    pool->free_slots = resize_array(pool->free_slots, capacity, sizeof(int));
+    pool->live = resize_array(pool->live, capacity, sizeof(int));
+    pool->live_index = resize_array(pool->live_index, capacity, sizeof(int));
+    pool->merged = resize_array(pool->merged, capacity, sizeof(int));
+    for (int i = pool->capacity; i < capacity; i++) {
+        projectiles[i].active = false;
+        pool->free_slots[pool->free_count++] = i;
+    }
+    pool->capacity = capacity;
+}
+
+void reset_projectile_pool() {
+    ProjectilePool *pool = &projectile_pool;
+    reserve_projectiles(config.projectile_capacity);
+    for (int i = 0; i < pool->capacity; i++) {
+        projectiles[i].active = false;
+        pool->free_slots[i] = i;
+    }
+    pool->free_count = pool->capacity;
+    pool->live_count = 0;
+}
+
+void barriers_changed();
+
+void init_game(uint64_t seed) {
+    game.seed = seed;
+    game.rng.state = seed;
     game.state = START;
     game.territory_hold_timer = 0.0f;
     game.protester_morale = 1.0f;
     game.police_morale = 1.0f;
+    game.protester_boost = 1.0f;
+    game.police_boost = 1.0f;
     game.cover_cycle_timer = 0.0f;
     game.last_police_count = 0;
     game.police_defeat_timer = 0.0f;
     game.cover_cycle_phase = 0;
-    for (int i = 0; i < 80; i++) {
-        Vector2 pos = {100 + (rand() % 600), 50 + (rand() % 620)};
-        init_entity(&protesters[i], pos, PROTESTER, SHOOTER);
+    game.tick = 0;
+    reset_projectile_pool();
+    select_scan_kernels();
+    protesters.count = 0;
+    police.count = 0;
+    reset_team_counts(&protester_counts);
+    reset_team_counts(&police_counts);
+    reserve_team(PROTESTER, config.protester_count);
+    reserve_team(POLICE, config.police_count);
+    for (int i = 0; i < config.protester_count; i++) {
+        float x = 100 + rng_int(&game.rng, 600);
+        float y = 50 + rng_int(&game.rng, 620);
+        spawn_entity((Vector2){x, y}, PROTESTER, SHOOTER);
     }
-    for (int i = 0; i < 59; i++) {
-        Vector2 pos = {680 + (rand() % 500), 50 + (rand() % 620)};
-        init_entity(&police[i], pos, POLICE, (rand() % 2 == 0) ? SHOOTER : MELEE);
+    for (int i = 0; i < config.police_count - 1; i++) {
+        float x = 680 + rng_int(&game.rng, 500);
+        float y = 50 + rng_int(&game.rng, 620);
+        spawn_entity((Vector2){x, y}, POLICE, (rng_int(&game.rng, 2) == 0) ? SHOOTER : MELEE);
     }
     Vector2 heli_pos = {900, 360};
-    init_entity(&police[59], heli_pos, POLICE, HELICOPTER);
-    game.last_police_count = 60;
-    for (int i = 0; i < MAX_BARRIERS; i++) {
-        barriers[i].active = false;
-    }
-    int barrier_index = 0;
-    int num_barriers = 12;
+    spawn_entity(heli_pos, POLICE, HELICOPTER);
+    game.last_police_count = police.count;
+    barrier_count = 0;
+    int num_barriers = config.barrier_count;
     float x_start = 400.0f;
     float x_end = 800.0f;
-    float x_spacing = (x_end - x_start) / (num_barriers - 1);
-    for (int i = 0; i < num_barriers && barrier_index < MAX_BARRIERS; i++) {
-        float x_pos = x_start + i * x_spacing + (float)(rand() % 50 - 25);
-        float y_pos = 100.0f + (rand() % (int)(SCREEN_HEIGHT - 200));
+    float x_spacing = num_barriers > 1 ? (x_end - x_start) / (num_barriers - 1) : 0.0f;
+    for (int i = 0; i < num_barriers; i++) {
+        float x_pos = x_start + i * x_spacing + (float)(rng_int(&game.rng, 50) - 25);
+        float y_pos = 100.0f + rng_int(&game.rng, SCREEN_HEIGHT - 200);
         Vector2 pos = {x_pos, y_pos};
-        init_barrier(&barriers[barrier_index], pos, (rand() % 2 == 0) ? CAR : CONCRETE);
-        barrier_index++;
+        BarrierType type = (rng_int(&game.rng, 2) == 0) ? CAR : CONCRETE;
+        int barrier_index = add_barrier();
+        init_barrier(&barriers[barrier_index], pos, type);
     }
+    barriers_changed();
 }
 
-void spawn_entity(Entity *entities, int max_entities, Vector2 pos, EntityType type, PoliceType police_type) {
-    for (int i = 0; i < max_entities; i++) {
-        if (!entities[i].active) {
-            init_entity(&entities[i], pos, type, police_type);
-            break;
-        }
+// Returns a slot to the free heap. The caller drops it from the live list.
+void release_projectile(int slot) {
+    ProjectilePool *pool = &projectile_pool;
+    int *heap = pool->free_slots;
+    int i = pool->free_count++;
+    while (i > 0 && slot < heap[(i - 1) / 2]) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
     }
+    heap[i] = slot;
+    projectiles[slot].active = false;
 }
 
-int find_nearest_barrier(Vector2 pos) {
-    float closest_dist = 100.0f;
-    int closest_id = -1;
-    for (int i = 0; i < MAX_BARRIERS; i++) {
-        if (barriers[i].active && barriers[i].start.x < pos.x) {
-            float dist = point_near_line(pos, barriers[i].start, barriers[i].end, COVER_WIDTH) ? 
-                         distance(pos, (Vector2){barriers[i].start.x, pos.y}) : 100.0f;
-            if (dist < closest_dist) {
-                closest_dist = dist;
-                closest_id = i;
-            }
-        }
+int take_free_slot() {
+    ProjectilePool *pool = &projectile_pool;
+    int *heap = pool->free_slots;
+    int top = heap[0];
+    int last = heap[--pool->free_count];
+    int i = 0;
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= pool->free_count) break;
+        if (child + 1 < pool->free_count && heap[child + 1] < heap[child]) child++;
+        if (heap[child] >= last) break;
+        heap[i] = heap[child];
+        i = child;
     }
-    return closest_id;
+    heap[i] = last;
+    return top;
+}
+
+bool launch_projectile(Vector2 pos, Vector2 dir, EntityType type) {
+    ProjectilePool *pool = &projectile_pool;
+    if (pool->free_count == 0) reserve_projectiles(pool->capacity * 2);
+    int slot = take_free_slot();
+    pool->live_index[slot] = pool->live_count;
+    pool->live[pool->live_count++] = slot;
+    projectiles[slot].position = pos;
+    projectiles[slot].velocity = Vector2Scale(Vector2Normalize(dir),
+        (type == PROTESTER ? STONE_SPEED : BULLET_SPEED));
+    projectiles[slot].type = type;
+    projectiles[slot].active = true;
+    projectiles[slot].distance_traveled = 0.0f;
+    return true;
 }
 
 void fire_projectile(Vector2 pos, Vector2 dir, EntityType type, Entity *entity) {
-    for (int i = 0; i < MAX_PROJECTILES; i++) {
-        if (!projectiles[i].active) {
-            projectiles[i].position = pos;
-            projectiles[i].velocity = Vector2Scale(Vector2Normalize(dir), 
-                (type == PROTESTER ? STONE_SPEED : BULLET_SPEED));
-            projectiles[i].type = type;
-            projectiles[i].active = true;
-            projectiles[i].distance_traveled = 0.0f;
-            entity->animation_timer = ANIMATION_DURATION;
-            break;
+    AIEffects *effects = entity->effects;
+    if (effects) {
+        if (effects->shot_count < MAX_SHOTS_PER_UPDATE) {
+            effects->shots[effects->shot_count++] = (Shot){pos, dir, type};
         }
+    } else if (launch_projectile(pos, dir, type)) {
+        entity->animation_timer = ANIMATION_DURATION;
     }
 }
 
-Vector2 compute_flocking(Entity *entity, int index, Entity *entities, int max_entities) {
-    Vector2 alignment = {0, 0};
-    Vector2 cohesion = {0, 0};
-    int count = 0;
-    for (int i = 0; i < max_entities; i++) {
-        if (i != index && entities[i].active && entities[i].ai_state != RETREATING && !entities[i].is_taking_cover && entities[i].ai_state != DYING) {
-            float dist = distance(entity->position, entities[i].position);
-            if (dist < FLOCKING_RADIUS && dist > 0) {
-                alignment = Vector2Add(alignment, entities[i].velocity);
-                cohesion = Vector2Add(cohesion, entities[i].position);
-                count++;
-            }
-        }
+int grid_coord(float v, int cells) {
+    int c = (int)(v / GRID_CELL_SIZE);
+    if (c < 0) return 0;
+    if (c >= cells) return cells - 1;
+    return c;
+}
+
+int grid_cell(float x, float y) {
+    return grid_coord(y, GRID_ROWS) * GRID_COLS + grid_coord(x, GRID_COLS);
+}
+
+void build_grid(SpatialGrid *grid, const EntityStore *store) {
+    if (grid->entry_capacity < store->count) {
+        grid->entry_capacity = store->count;
+        grid->entries = resize_array(grid->entries, grid->entry_capacity, sizeof(int));
     }
-    if (count > 0) {
-        alignment = Vector2Scale(alignment, 1.0f / count);
-        cohesion = Vector2Scale(cohesion, 1.0f / count);
-        cohesion = Vector2Subtract(cohesion, entity->position);
-        alignment = Vector2Normalize(alignment);
-        cohesion = Vector2Normalize(cohesion);
-        Vector2 flocking = Vector2Add(alignment, cohesion);
-        flocking = Vector2Scale(flocking, FLOCKING_WEIGHT * ENTITY_SPEED);
-        return flocking;
+    for (int c = 0; c <= GRID_CELLS; c++) grid->cell_start[c] = 0;
+    for (int i = 0; i < store->count; i++) {
+        if (store->active[i]) grid->cell_start[grid_cell(store->pos_x[i], store->pos_y[i]) + 1]++;
+    }
+    for (int c = 0; c < GRID_CELLS; c++) grid->cell_start[c + 1] += grid->cell_start[c];
+    int fill[GRID_CELLS];
+    for (int c = 0; c < GRID_CELLS; c++) fill[c] = grid->cell_start[c];
+    for (int i = 0; i < store->count; i++) {
+        if (store->active[i]) grid->entries[fill[grid_cell(store->pos_x[i], store->pos_y[i])]++] = i;
     }
-    return (Vector2){0, 0};
 }
 
-Vector2 avoid_collisions(Entity *entity, int index, Entity *entities, int max_entities) {
-    Vector2 avoidance = {0, 0};
-    int count = 0;
-    for (int i = 0; i < max_entities; i++) {
-        if (i != index && entities[i].active) {
-            float dist = distance(entity->position, entities[i].position);
-            if (dist < 20.0f && dist > 0) {
-                Vector2 dir = Vector2Subtract(entity->position, entities[i].position);
-                avoidance = Vector2Add(avoidance, Vector2Scale(dir, 1.0f / dist));
-                count++;
-            }
+// Cell rectangle covering a circle of the given radius.
+void grid_query_bounds(Vector2 pos, float radius, int *cx0, int *cy0, int *cx1, int *cy1) {
+    *cx0 = grid_coord(pos.x - radius, GRID_COLS);
+    *cx1 = grid_coord(pos.x + radius, GRID_COLS);
+    *cy0 = grid_coord(pos.y - radius, GRID_ROWS);
+    *cy1 = grid_coord(pos.y + radius, GRID_ROWS);
+}
+
+// Cell rectangle covering a barrier and everything within BARRIER_REACH.
+void barrier_cells(const Barrier *barrier, int *cx0, int *cy0, int *cx1, int *cy1) {
+    *cx0 = grid_coord(fminf(barrier->start.x, barrier->end.x) - BARRIER_REACH, GRID_COLS);
+    *cx1 = grid_coord(fmaxf(barrier->start.x, barrier->end.x) + BARRIER_REACH, GRID_COLS);
+    *cy0 = grid_coord(fminf(barrier->start.y, barrier->end.y) - BARRIER_REACH, GRID_ROWS);
+    *cy1 = grid_coord(fmaxf(barrier->start.y, barrier->end.y) + BARRIER_REACH, GRID_ROWS);
+}
+
+void build_barrier_grid() {
+    BarrierGrid *grid = &barrier_grid;
+    int cx0, cy0, cx1, cy1;
+    for (int c = 0; c <= GRID_CELLS; c++) grid->cell_start[c] = 0;
+    for (int i = 0; i < barrier_count; i++) {
+        if (!barriers[i].active) continue;
+        barrier_cells(&barriers[i], &cx0, &cy0, &cx1, &cy1);
+        for (int cy = cy0; cy <= cy1; cy++) {
+            for (int cx = cx0; cx <= cx1; cx++) grid->cell_start[cy * GRID_COLS + cx + 1]++;
         }
     }
-    for (int i = 0; i < MAX_BARRIERS; i++) {
-        if (barriers[i].active) {
-            float dist = point_near_line(entity->position, barriers[i].start, barriers[i].end, BARRIER_AVOIDANCE_RANGE) ?
-                         distance(entity->position, (Vector2){barriers[i].start.x, entity->position.y}) : 10000.0f;
-            if (dist < BARRIER_AVOIDANCE_RANGE && dist > 0) {
-                Vector2 dir = Vector2Subtract(entity->position, (Vector2){barriers[i].start.x, entity->position.y});
-                avoidance = Vector2Add(avoidance, Vector2Scale(dir, BARRIER_AVOIDANCE_FORCE / dist));
-                count++;
-            }
+    for (int c = 0; c < GRID_CELLS; c++) grid->cell_start[c + 1] += grid->cell_start[c];
+    if (grid->entry_capacity < grid->cell_start[GRID_CELLS]) {
+        grid->entry_capacity = grid->cell_start[GRID_CELLS];
+        grid->entries = resize_array(grid->entries, grid->entry_capacity, sizeof(int));
+    }
+    int fill[GRID_CELLS];
+    for (int c = 0; c < GRID_CELLS; c++) fill[c] = grid->cell_start[c];
+    for (int i = 0; i < barrier_count; i++) {
+        if (!barriers[i].active) continue;
+        barrier_cells(&barriers[i], &cx0, &cy0, &cx1, &cy1);
+        for (int cy = cy0; cy <= cy1; cy++) {
+            for (int cx = cx0; cx <= cx1; cx++) grid->entries[fill[cy * GRID_COLS + cx]++] = i;
+        }
+    }
+}
+
+// Barriers that may lie within BARRIER_REACH of p, in index order.
+const int *barriers_near(Vector2 p, int *count) {
+    int c = grid_cell(p.x, p.y);
+    *count = barrier_grid.cell_start[c + 1] - barrier_grid.cell_start[c];
+    return &barrier_grid.entries[barrier_grid.cell_start[c]];
+}
+
+// Calls visit for the barriers of every cell the segment p0-p1 passes
+// through, column by column, until it returns false. A barrier spanning
+// several of those cells is visited once per cell.
+void visit_barriers_along(Vector2 p0, Vector2 p1, BarrierVisit visit, void *ctx) {
+    const BarrierGrid *grid = &barrier_grid;
+    float min_x = fminf(p0.x, p1.x), max_x = fmaxf(p0.x, p1.x);
+    int cx0 = grid_coord(min_x, GRID_COLS), cx1 = grid_coord(max_x, GRID_COLS);
+    for (int cx = cx0; cx <= cx1; cx++) {
+        // y span of the segment inside this column, padded for rounding.
+        float x_lo = cx == cx0 ? min_x : (float)(cx * GRID_CELL_SIZE);
+        float x_hi = cx == cx1 ? max_x : (float)((cx + 1) * GRID_CELL_SIZE);
+        float y_lo = fminf(p0.y, p1.y), y_hi = fmaxf(p0.y, p1.y);
+        if (p1.x != p0.x) {
+            float slope = (p1.y - p0.y) / (p1.x - p0.x);
+            float ya = p0.y + (x_lo - p0.x) * slope, yb = p0.y + (x_hi - p0.x) * slope;
+            y_lo = fmaxf(y_lo, fminf(ya, yb));
+            y_hi = fminf(y_hi, fmaxf(ya, yb));
+        }
+        int cy0 = grid_coord(y_lo - 1.0f, GRID_ROWS), cy1 = grid_coord(y_hi + 1.0f, GRID_ROWS);
+        for (int cy = cy0; cy <= cy1; cy++) {
+            int c = cy * GRID_COLS + cx;
+            for (int k = grid->cell_start[c]; k < grid->cell_start[c + 1]; k++) {
+                if (!visit(ctx, grid->entries[k])) return;
+            }
+        }
+    }
+}
+
+// True when p is within COVER_WIDTH of a barrier.
+bool blocked_by_barrier(Vector2 p) {
+    int count;
+    const int *near = barriers_near(p, &count);
+    for (int k = 0; k < count; k++) {
+        const Barrier *barrier = &barriers[near[k]];
+        if (barrier->active && point_near_line(p, barrier->start, barrier->end, COVER_WIDTH)) return true;
+    }
+    return false;
+}
+
+typedef struct {
+    Vector2 start;
+    Vector2 target;
+    bool clear;
+} ShotCheck;
+
+bool check_shot_barrier(void *ctx, int i) {
+    ShotCheck *shot = ctx;
+    Vector2 start = shot->start, target = shot->target;
+    Vector2 barrier_center = {barriers[i].start.x, 
+                             (barriers[i].start.y + barriers[i].end.y) / 2};
+    if (barrier_center.x > start.x && barrier_center.x < target.x) {
+        float t = (barriers[i].start.x - start.x) / (target.x - start.x);
+        if (t >= 0 && t <= 1) {
+            float y_intersect = start.y + t * (target.y - start.y);
+            if (y_intersect >= barriers[i].start.y - COVER_WIDTH / 2 &&
+                y_intersect <= barriers[i].end.y + COVER_WIDTH / 2) {
+                shot->clear = false;
+            }
+        }
+    }
+    return shot->clear;
+}
+
+bool has_clear_shot(Vector2 start, Vector2 target) {
+    if (!(target.x > start.x)) return true;
+    ShotCheck shot = {start, target, true};
+    visit_barriers_along(start, target, check_shot_barrier, &shot);
+    return shot.clear;
+}
+
+void build_cover_slots() {
+    CoverSlots *slots = &cover_slots;
+    int needed = barrier_count * COVER_SLOTS_PER_BARRIER;
+    if (slots->capacity < needed) {
+        slots->capacity = needed;
+        slots->pos = resize_array(slots->pos, needed, sizeof(Vector2));
+        slots->barrier = resize_array(slots->barrier, needed, sizeof(int));
+        slots->reserved = resize_array(slots->reserved, needed, sizeof(bool));
+        slots->entries = resize_array(slots->entries, needed, sizeof(int));
+    }
+    slots->count = 0;
+    for (int i = 0; i < barrier_count; i++) {
+        const Barrier *barrier = &barriers[i];
+        if (!barrier->active) continue;
+        for (int k = 0; k < COVER_SLOTS_PER_BARRIER; k++) {
+            float t = (k + 0.5f) / COVER_SLOTS_PER_BARRIER;
+            int slot = slots->count++;
+            slots->pos[slot] = (Vector2){barrier->start.x + COVER_SLOT_OFFSET,
+                                         barrier->start.y + t * (barrier->end.y - barrier->start.y)};
+            slots->barrier[slot] = i;
+            slots->reserved[slot] = false;
+        }
+    }
+    for (int c = 0; c <= GRID_CELLS; c++) slots->cell_start[c] = 0;
+    for (int i = 0; i < slots->count; i++) slots->cell_start[grid_cell(slots->pos[i].x, slots->pos[i].y) + 1]++;
+    for (int c = 0; c < GRID_CELLS; c++) slots->cell_start[c + 1] += slots->cell_start[c];
+    int fill[GRID_CELLS];
+    for (int c = 0; c < GRID_CELLS; c++) fill[c] = slots->cell_start[c];
+    for (int i = 0; i < slots->count; i++) slots->entries[fill[grid_cell(slots->pos[i].x, slots->pos[i].y)]++] = i;
+}
+
+// Nearest unreserved slot of a barrier that pos is touching from the east,
+// ties to the lower slot, or -1. Cover stays as rare as when units could
+// only hide behind the barrier they were pressed against. Only the grid
+// cells around pos are looked at.
+int find_free_cover_slot(Vector2 pos) {
+    const CoverSlots *slots = &cover_slots;
+    float closest_dist = COVER_HEIGHT * COVER_HEIGHT;
+    int closest_slot = -1;
+    int cx0, cy0, cx1, cy1;
+    grid_query_bounds(pos, COVER_HEIGHT, &cx0, &cy0, &cx1, &cy1);
+    for (int cy = cy0; cy <= cy1; cy++) {
+        for (int cx = cx0; cx <= cx1; cx++) {
+            int c = cy * GRID_COLS + cx;
+            for (int k = slots->cell_start[c]; k < slots->cell_start[c + 1]; k++) {
+                int slot = slots->entries[k];
+                if (slots->reserved[slot]) continue;
+                const Barrier *barrier = &barriers[slots->barrier[slot]];
+                if (!(barrier->start.x < pos.x) || !point_near_line(pos, barrier->start, barrier->end, COVER_WIDTH)) continue;
+                float dist = distance_sq(pos, slots->pos[slot]);
+                if (dist < closest_dist || (dist == closest_dist && slot < closest_slot)) {
+                    closest_dist = dist;
+                    closest_slot = slot;
+                }
+            }
+        }
+    }
+    return closest_slot;
+}
+
+// Min-heap on cost, ties on the lower cell, so the build order is fixed.
+bool flow_node_before(FlowNode a, FlowNode b) {
+    return a.cost < b.cost || (a.cost == b.cost && a.cell < b.cell);
+}
+
+void flow_push(FlowNode *heap, int *count, FlowNode node) {
+    int i = (*count)++;
+    while (i > 0 && flow_node_before(node, heap[(i - 1) / 2])) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = node;
+}
+
+FlowNode flow_pop(FlowNode *heap, int *count) {
+    FlowNode top = heap[0];
+    FlowNode last = heap[--(*count)];
+    int i = 0;
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= *count) break;
+        if (child + 1 < *count && flow_node_before(heap[child + 1], heap[child])) child++;
+        if (!flow_node_before(heap[child], last)) break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = last;
+    return top;
+}
+
+bool flow_cell_blocked(int cx, int cy) {
+    Vector2 center = {(cx + 0.5f) * FLOW_CELL_SIZE, (cy + 0.5f) * FLOW_CELL_SIZE};
+    int count;
+    const int *near = barriers_near(center, &count);
+    for (int k = 0; k < count; k++) {
+        const Barrier *barrier = &barriers[near[k]];
+        if (barrier->active && point_near_line(center, barrier->start, barrier->end, FLOW_CLEARANCE)) return true;
+    }
+    return false;
+}
+
+// Dijkstra over 8-connected cells from the column holding the territory
+// line. Diagonal steps may not cut the corner of a blocked cell.
+void build_flow_field() {
+    static const int dx[8] = {1, -1, 0, 0, 1, 1, -1, -1};
+    static const int dy[8] = {0, 0, 1, -1, 1, -1, 1, -1};
+    static bool blocked[FLOW_CELLS];
+    static FlowNode heap[FLOW_CELLS * 8];
+    FlowField *field = &flow_field;
+    int heap_count = 0;
+    int goal_col = (int)(PROTESTER_TERRITORY_X / FLOW_CELL_SIZE);
+    for (int cy = 0; cy < FLOW_ROWS; cy++) {
+        for (int cx = 0; cx < FLOW_COLS; cx++) {
+            int c = cy * FLOW_COLS + cx;
+            blocked[c] = flow_cell_blocked(cx, cy);
+            field->cost[c] = INFINITY;
+            field->dir[c] = (Vector2){0, 0};
+            if (cx == goal_col && !blocked[c]) {
+                field->cost[c] = 0.0f;
+                flow_push(heap, &heap_count, (FlowNode){0.0f, c});
+            }
+        }
+    }
+    while (heap_count > 0) {
+        FlowNode node = flow_pop(heap, &heap_count);
+        if (node.cost > field->cost[node.cell]) continue;
+        int cx = node.cell % FLOW_COLS, cy = node.cell / FLOW_COLS;
+        for (int k = 0; k < 8; k++) {
+            int nx = cx + dx[k], ny = cy + dy[k];
+            if (nx < 0 || nx >= FLOW_COLS || ny < 0 || ny >= FLOW_ROWS) continue;
+            int n = ny * FLOW_COLS + nx;
+            if (blocked[n]) continue;
+            if (k >= 4 && (blocked[cy * FLOW_COLS + nx] || blocked[ny * FLOW_COLS + cx])) continue;
+            float cost = node.cost + (k >= 4 ? 1.41421356f : 1.0f);
+            if (cost < field->cost[n]) {
+                field->cost[n] = cost;
+                field->dir[n] = Vector2Normalize((Vector2){(float)-dx[k], (float)-dy[k]});
+                flow_push(heap, &heap_count, (FlowNode){cost, n});
+            }
+        }
+    }
+}
+
+// Direction toward the territory line from pos, blended from the four
+// nearest cells. Falls back to heading straight for the line on the line
+// itself and where the field has no path.
+Vector2 flow_direction(Vector2 pos) {
+    const FlowField *field = &flow_field;
+    float fx = pos.x / FLOW_CELL_SIZE - 0.5f, fy = pos.y / FLOW_CELL_SIZE - 0.5f;
+    int x0 = (int)floorf(fx), y0 = (int)floorf(fy);
+    float tx = fx - x0, ty = fy - y0;
+    Vector2 sum = {0, 0};
+    bool on_line = false;
+    for (int k = 0; k < 4; k++) {
+        int cx = x0 + (k & 1), cy = y0 + (k >> 1);
+        if (cx < 0 || cx >= FLOW_COLS || cy < 0 || cy >= FLOW_ROWS) continue;
+        int c = cy * FLOW_COLS + cx;
+        if (field->cost[c] == 0.0f) on_line = true;
+        float weight = ((k & 1) ? tx : 1.0f - tx) * ((k >> 1) ? ty : 1.0f - ty);
+        sum = Vector2Add(sum, Vector2Scale(field->dir[c], weight));
+    }
+    if (on_line || Vector2Length(sum) < 0.01f) {
+        return Vector2Normalize((Vector2){PROTESTER_TERRITORY_X - pos.x, 0});
+    }
+    return Vector2Normalize(sum);
+}
+
+// Call after any change to barriers.
+void barriers_changed() {
+    barrier_version++;
+    build_barrier_grid();
+    build_cover_slots();
+    build_flow_field();
+}
+
+Vector2 compute_flocking(Entity *entity, int index, const EntityStore *store, const SpatialGrid *grid) {
+    Vector2 alignment = {0, 0};
+    Vector2 cohesion = {0, 0};
+    int count = 0;
+    int cx0, cy0, cx1, cy1;
+    // The grid holds start-of-tick positions, hence the slack.
+    grid_query_bounds(entity->position, FLOCKING_RADIUS + GRID_SLACK, &cx0, &cy0, &cx1, &cy1);
+    for (int cy = cy0; cy <= cy1; cy++) {
+        for (int cx = cx0; cx <= cx1; cx++) {
+            int c = cy * GRID_COLS + cx;
+            for (int k = grid->cell_start[c]; k < grid->cell_start[c + 1]; k++) {
+                int i = grid->entries[k];
+                if (i != index && store->active[i] && store->ai_state[i] != RETREATING && !store->taking_cover[i] && store->ai_state[i] != DYING) {
+                    Vector2 other = store_position(store, i);
+                    float dist = distance(entity->position, other);
+                    if (dist < FLOCKING_RADIUS && dist > 0) {
+                        alignment = Vector2Add(alignment, store_velocity(store, i));
+                        cohesion = Vector2Add(cohesion, other);
+                        count++;
+                    }
+                }
+            }
+        }
+    }
+    if (count > 0) {
+        alignment = Vector2Scale(alignment, 1.0f / count);
+        cohesion = Vector2Scale(cohesion, 1.0f / count);
+        cohesion = Vector2Subtract(cohesion, entity->position);
+        alignment = Vector2Normalize(alignment);
+        cohesion = Vector2Normalize(cohesion);
+        Vector2 flocking = Vector2Add(alignment, cohesion);
+        flocking = Vector2Scale(flocking, FLOCKING_WEIGHT * ENTITY_SPEED);
+        return flocking;
+    }
+    return (Vector2){0, 0};
+}
+
+Vector2 avoid_collisions(Entity *entity, int index, const EntityStore *store, const SpatialGrid *grid) {
+    Vector2 avoidance = {0, 0};
+    int count = 0;
+    int cx0, cy0, cx1, cy1;
+    grid_query_bounds(entity->position, SEPARATION_RADIUS + GRID_SLACK, &cx0, &cy0, &cx1, &cy1);
+    for (int cy = cy0; cy <= cy1; cy++) {
+        for (int cx = cx0; cx <= cx1; cx++) {
+            int c = cy * GRID_COLS + cx;
+            for (int k = grid->cell_start[c]; k < grid->cell_start[c + 1]; k++) {
+                int i = grid->entries[k];
+                if (i != index && store->active[i]) {
+                    Vector2 other = store_position(store, i);
+                    float dist = distance(entity->position, other);
+                    if (dist < SEPARATION_RADIUS && dist > 0) {
+                        Vector2 dir = Vector2Subtract(entity->position, other);
+                        avoidance = Vector2Add(avoidance, Vector2Scale(dir, 1.0f / dist));
+                        count++;
+                    }
+                }
+            }
+        }
+    }
+    int near_count;
+    const int *near = barriers_near(entity->position, &near_count);
+    for (int k = 0; k < near_count; k++) {
+        int i = near[k];
+        if (barriers[i].active) {
+            float dist = point_near_line(entity->position, barriers[i].start, barriers[i].end, BARRIER_AVOIDANCE_RANGE) ?
+                         distance(entity->position, (Vector2){barriers[i].start.x, entity->position.y}) : 10000.0f;
+            if (dist < BARRIER_AVOIDANCE_RANGE && dist > 0) {
+                Vector2 dir = Vector2Subtract(entity->position, (Vector2){barriers[i].start.x, entity->position.y});
+                avoidance = Vector2Add(avoidance, Vector2Scale(dir, BARRIER_AVOIDANCE_FORCE / dist));
+                count++;
+            }
         }
     }
     if (count > 0) {
@@ -319,60 +1709,244 @@ Vector2 avoid_collisions(Entity *entity, int index, Entity *entities, int max_en
     return avoidance;
 }
 
-Vector2 find_densest_enemy_area(Entity *entity, EntityType type) {
-    Entity *enemies = (type == PROTESTER) ? police : protesters;
-    int max_enemies = (type == PROTESTER) ? MAX_POLICE : MAX_PROTESTERS;
-    Vector2 center = {0, 0};
-    float max_score = 0;
-    for (int i = 0; i < max_enemies; i++) {
-        if (enemies[i].active && enemies[i].ai_state != DYING) {
-            int count = 0;
-            Vector2 sum = {0, 0};
-            for (int j = 0; j < max_enemies; j++) {
-                if (enemies[j].active && enemies[j].ai_state != DYING && distance(enemies[i].position, enemies[j].position) < DENSITY_RADIUS) {
-                    sum = Vector2Add(sum, enemies[j].position);
-                    count++;
-                }
+int density_coord(float v, int bins) {
+    int b = (int)(v / DENSITY_BIN_SIZE);
+    if (b < 0) return 0;
+    if (b >= bins) return bins - 1;
+    return b;
+}
+
+bool density_inside(float x, float y) {
+    return x >= 0 && x < DENSITY_COLS * DENSITY_BIN_SIZE &&
+           y >= 0 && y < DENSITY_ROWS * DENSITY_BIN_SIZE;
+}
+
+int density_bin(float x, float y) {
+    return density_coord(y, DENSITY_ROWS) * DENSITY_COLS + density_coord(x, DENSITY_COLS);
+}
+
+bool density_member(const EntityStore *store, int i) {
+    return store->active[i] && store->ai_state[i] != DYING;
+}
+
+int sat_index(int row, int col) {
+    return row * (DENSITY_COLS + 1) + col;
+}
+
+// Sum of the bins in row `row`, columns first..last inclusive.
+void density_row_sum(const DensityMap *map, int row, int first, int last, int *count, double *sum_x, double *sum_y) {
+    int a = sat_index(row + 1, last + 1), b = sat_index(row, last + 1);
+    int c = sat_index(row + 1, first), d = sat_index(row, first);
+    *count += map->count_sat[a] - map->count_sat[b] - map->count_sat[c] + map->count_sat[d];
+    *sum_x += map->sum_x_sat[a] - map->sum_x_sat[b] - map->sum_x_sat[c] + map->sum_x_sat[d];
+    *sum_y += map->sum_y_sat[a] - map->sum_y_sat[b] - map->sum_y_sat[c] + map->sum_y_sat[d];
+}
+
+void density_bin_scan(const DensityMap *map, const EntityStore *store, int bin, Vector2 center,
+                      int *count, double *sum_x, double *sum_y) {
+    for (int k = map->bin_start[bin]; k < map->bin_start[bin + 1]; k++) {
+        Vector2 other = store_position(store, map->entries[k]);
+        if (distance(center, other) < DENSITY_RADIUS) {
+            *count += 1;
+            *sum_x += other.x;
+            *sum_y += other.y;
+        }
+    }
+}
+
+// Members of the team within DENSITY_RADIUS of center. Bins whose farthest
+// corner is inside the radius (with a 1px margin for rounding) come straight
+// from the summed-area tables; everything else is checked exactly.
+int density_gather(const DensityMap *map, const EntityStore *store, Vector2 center, double *sum_x, double *sum_y) {
+    int count = 0;
+    *sum_x = 0;
+    *sum_y = 0;
+    float inner = DENSITY_RADIUS - 1.0f;
+    int cx0 = density_coord(center.x - DENSITY_RADIUS, DENSITY_COLS);
+    int cx1 = density_coord(center.x + DENSITY_RADIUS, DENSITY_COLS);
+    int cy0 = density_coord(center.y - DENSITY_RADIUS, DENSITY_ROWS);
+    int cy1 = density_coord(center.y + DENSITY_RADIUS, DENSITY_ROWS);
+    for (int cy = cy0; cy <= cy1; cy++) {
+        float y0 = (float)(cy * DENSITY_BIN_SIZE);
+        float dy = fmaxf(fabsf(y0 - center.y), fabsf(y0 + DENSITY_BIN_SIZE - center.y));
+        int first = cx1 + 1, last = cx1;
+        if (dy < inner) {
+            float half = sqrtf(inner * inner - dy * dy);
+            int a = (int)ceilf((center.x - half) / DENSITY_BIN_SIZE);
+            int b = (int)floorf((center.x + half) / DENSITY_BIN_SIZE) - 1;
+            if (a < cx0) a = cx0;
+            if (b > cx1) b = cx1;
+            if (a <= b) {
+                first = a;
+                last = b;
+                density_row_sum(map, cy, first, last, &count, sum_x, sum_y);
             }
-            if (count > 0) {
-                Vector2 avg_pos = Vector2Scale(sum, 1.0f / count);
-                float score = count * (type == PROTESTER ? 
-                    (1.0f + 0.5f * (SCREEN_WIDTH - avg_pos.x) / SCREEN_WIDTH) : 1.0f);
-                if (score > max_score) {
-                    max_score = score;
-                    center = avg_pos;
+        }
+        for (int cx = cx0; cx < first; cx++) {
+            density_bin_scan(map, store, cy * DENSITY_COLS + cx, center, &count, sum_x, sum_y);
+        }
+        for (int cx = last + 1; cx <= cx1; cx++) {
+            density_bin_scan(map, store, cy * DENSITY_COLS + cx, center, &count, sum_x, sum_y);
+        }
+    }
+    for (int k = 0; k < map->outside_count; k++) {
+        Vector2 other = store_position(store, map->outside[k]);
+        if (distance(center, other) < DENSITY_RADIUS) {
+            count++;
+            *sum_x += other.x;
+            *sum_y += other.y;
+        }
+    }
+    return count;
+}
+
+int compare_ints(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+float density_score(int count, Vector2 avg_pos, bool low_x_bias) {
+    return count * (low_x_bias ? (1.0f + 0.5f * (SCREEN_WIDTH - avg_pos.x) / SCREEN_WIDTH) : 1.0f);
+}
+
+// Average position of the members within DENSITY_RADIUS of center, summed in
+// float in index order like the old all-pairs loop, so it matches that loop
+// to the bit. Returns the member count.
+int density_exact_center(DensityMap *map, const EntityStore *store, Vector2 center, Vector2 *avg_pos) {
+    int count = 0;
+    int cx0 = density_coord(center.x - DENSITY_RADIUS, DENSITY_COLS);
+    int cx1 = density_coord(center.x + DENSITY_RADIUS, DENSITY_COLS);
+    int cy0 = density_coord(center.y - DENSITY_RADIUS, DENSITY_ROWS);
+    int cy1 = density_coord(center.y + DENSITY_RADIUS, DENSITY_ROWS);
+    for (int cy = cy0; cy <= cy1; cy++) {
+        for (int cx = cx0; cx <= cx1; cx++) {
+            int bin = cy * DENSITY_COLS + cx;
+            for (int k = map->bin_start[bin]; k < map->bin_start[bin + 1]; k++) {
+                if (distance(center, store_position(store, map->entries[k])) < DENSITY_RADIUS) {
+                    map->members[count++] = map->entries[k];
                 }
             }
         }
     }
-    return max_score > 0 ? center : (Vector2){PROTESTER_TERRITORY_X, entity->position.y};
+    for (int k = 0; k < map->outside_count; k++) {
+        if (distance(center, store_position(store, map->outside[k])) < DENSITY_RADIUS) {
+            map->members[count++] = map->outside[k];
+        }
+    }
+    qsort(map->members, count, sizeof(int), compare_ints);
+    Vector2 sum = {0, 0};
+    for (int k = 0; k < count; k++) sum = Vector2Add(sum, store_position(store, map->members[k]));
+    *avg_pos = Vector2Scale(sum, 1.0f / count);
+    return count;
 }
 
-void find_closest_enemy(Entity *entity, EntityType type, float *closest_dist, int *closest_enemy, Vector2 *target_pos) {
-    Entity *enemies = (type == PROTESTER) ? police : protesters;
-    int max_enemies = (type == PROTESTER) ? MAX_POLICE : MAX_PROTESTERS;
-    *closest_dist = 10000.0f;
-    *closest_enemy = -1;
-    for (int i = 0; i < max_enemies; i++) {
-        if (enemies[i].active && enemies[i].ai_state != DYING && (!type == PROTESTER || !enemies[i].is_taking_cover)) {
-            float dist = distance(entity->position, enemies[i].position);
-            float score = dist;
-            if (type == PROTESTER) {
-                score *= (1.0f + 0.5f * (SCREEN_WIDTH - enemies[i].position.x) / SCREEN_WIDTH);
-            }
-            if (score < *closest_dist) {
-                *closest_dist = score;
-                *closest_enemy = i;
-                *target_pos = enemies[i].position;
-            }
+// Scores every member by the size of the cluster around it, as the old
+// all-pairs loop did; low_x_bias favours clusters nearer the protester side.
+// The tables give exact counts but only near averages, so members whose
+// score is within rounding of the best are rescored with
+// density_exact_center and the winner and its center match the old loop
+// exactly. Without the bias the score is the count itself and the first
+// member with the top count wins.
+void build_density_map(DensityMap *map, const EntityStore *store, bool low_x_bias) {
+    if (map->entry_capacity < store->count) {
+        map->entry_capacity = store->count;
+        map->entries = resize_array(map->entries, map->entry_capacity, sizeof(int));
+        map->outside = resize_array(map->outside, map->entry_capacity, sizeof(int));
+        map->members = resize_array(map->members, map->entry_capacity, sizeof(int));
+        map->scores = resize_array(map->scores, map->entry_capacity, sizeof(float));
+    }
+    for (int b = 0; b <= DENSITY_BINS; b++) map->bin_start[b] = 0;
+    for (int i = 0; i < DENSITY_SAT_SIZE; i++) {
+        map->count_sat[i] = 0;
+        map->sum_x_sat[i] = 0;
+        map->sum_y_sat[i] = 0;
+    }
+    map->outside_count = 0;
+    for (int i = 0; i < store->count; i++) {
+        if (!density_member(store, i)) continue;
+        if (density_inside(store->pos_x[i], store->pos_y[i])) {
+            int b = density_bin(store->pos_x[i], store->pos_y[i]);
+            int cell = sat_index(b / DENSITY_COLS + 1, b % DENSITY_COLS + 1);
+            map->bin_start[b + 1]++;
+            map->count_sat[cell]++;
+            map->sum_x_sat[cell] += store->pos_x[i];
+            map->sum_y_sat[cell] += store->pos_y[i];
+        } else {
+            map->outside[map->outside_count++] = i;
+        }
+    }
+    for (int b = 0; b < DENSITY_BINS; b++) map->bin_start[b + 1] += map->bin_start[b];
+    int fill[DENSITY_BINS];
+    for (int b = 0; b < DENSITY_BINS; b++) fill[b] = map->bin_start[b];
+    for (int i = 0; i < store->count; i++) {
+        if (density_member(store, i) && density_inside(store->pos_x[i], store->pos_y[i])) {
+            map->entries[fill[density_bin(store->pos_x[i], store->pos_y[i])]++] = i;
+        }
+    }
+    for (int row = 1; row <= DENSITY_ROWS; row++) {
+        for (int col = 1; col <= DENSITY_COLS; col++) {
+            int i = sat_index(row, col), up = sat_index(row - 1, col);
+            int left = sat_index(row, col - 1), diag = sat_index(row - 1, col - 1);
+            map->count_sat[i] += map->count_sat[up] + map->count_sat[left] - map->count_sat[diag];
+            map->sum_x_sat[i] += map->sum_x_sat[up] + map->sum_x_sat[left] - map->sum_x_sat[diag];
+            map->sum_y_sat[i] += map->sum_y_sat[up] + map->sum_y_sat[left] - map->sum_y_sat[diag];
         }
     }
+    float near_max = 0;
+    for (int i = 0; i < store->count; i++) {
+        map->scores[i] = 0;
+        if (!density_member(store, i)) continue;
+        double sum_x, sum_y;
+        int count = density_gather(map, store, store_position(store, i), &sum_x, &sum_y);
+        if (count > 0) {
+            Vector2 avg_pos = {(float)(sum_x / count), (float)(sum_y / count)};
+            map->scores[i] = density_score(count, avg_pos, low_x_bias);
+            if (map->scores[i] > near_max) near_max = map->scores[i];
+        }
+    }
+    float threshold = low_x_bias ? near_max * (1.0f - 1e-3f) : near_max;
+    float max_score = 0;
+    map->center = (Vector2){0, 0};
+    for (int i = 0; i < store->count && near_max > 0; i++) {
+        if (map->scores[i] <= 0 || map->scores[i] < threshold) continue;
+        Vector2 avg_pos;
+        int count = density_exact_center(map, store, store_position(store, i), &avg_pos);
+        float score = density_score(count, avg_pos, low_x_bias);
+        if (score > max_score) {
+            max_score = score;
+            map->center = avg_pos;
+        }
+        if (!low_x_bias) break;
+    }
+    map->found = max_score > 0;
+    map->valid = true;
+}
+
+Vector2 find_densest_enemy_area(Entity *entity, EntityType type) {
+    DensityMap *map = (type == PROTESTER) ? &police_density : &protester_density;
+    if (!map->valid) {
+        if (type == PROTESTER) {
+            build_density_map(map, &police, true);
+        } else {
+            build_density_map(map, &protesters, false);
+        }
+    }
+    return map->found ? map->center : (Vector2){PROTESTER_TERRITORY_X, entity->position.y};
+}
+
+void find_closest_enemy(Entity *entity, EntityType type, float *closest_dist, int *closest_enemy, Vector2 *target_pos) {
+    const EntityStore *enemies = (type == PROTESTER) ? &police : &protesters;
+    // Protesters ignore police in cover and prefer targets further east.
+    NearestQuery query = {enemies, entity->position, 10000.0f, true, type == PROTESTER, type == PROTESTER};
+    *closest_enemy = find_nearest(&query, closest_dist);
+    if (*closest_enemy != -1) {
+        *target_pos = store_position(enemies, *closest_enemy);
+    }
 }
 
-void update_morale() {
-    int active_protesters = 0, active_police = 0;
-    for (int i = 0; i < MAX_PROTESTERS; i++) if (protesters[i].active) active_protesters++;
-    for (int i = 0; i < MAX_POLICE; i++) if (police[i].active && police[i].ai_state != DYING) active_police++;
+void update_morale(float dt) {
+    int active_protesters = atomic_load(&protester_counts.active);
+    int active_police = fighting_units(&police_counts);
     if (game.last_police_count - active_police > 5 && game.police_defeat_timer <= 0) {
         game.police_defeat_timer = MORALE_PENALTY_DURATION;
     }
@@ -380,66 +1954,72 @@ void update_morale() {
     float total = active_protesters + active_police;
     game.protester_morale = total > 0 ? (float)active_protesters / total : 0.5f;
     game.police_morale = total > 0 ? (float)active_police / total : 0.5f;
-    for (int i = 0; i < MAX_PROTESTERS; i++) {
-        if (protesters[i].active) {
-            protesters[i].morale_boost = 1.0f + 0.2f * game.protester_morale;
-        }
-    }
-    for (int i = 0; i < MAX_POLICE; i++) {
-        if (police[i].active) {
-            float penalty = (game.police_defeat_timer > 0) ? MORALE_PENALTY_FACTOR : 1.0f;
-            police[i].morale_boost = (1.0f + 0.2f * game.police_morale) * penalty;
-            if (police[i].morale_penalty_timer > 0) {
-                police[i].morale_penalty_timer -= GetFrameTime();
-            }
-        }
-    }
+    game.protester_boost = 1.0f + 0.2f * game.protester_morale;
+    float penalty = (game.police_defeat_timer > 0) ? MORALE_PENALTY_FACTOR : 1.0f;
+    game.police_boost = (1.0f + 0.2f * game.police_morale) * penalty;
     if (game.police_defeat_timer > 0) {
-        game.police_defeat_timer -= GetFrameTime();
+        game.police_defeat_timer -= dt;
     }
 }
 
-void update_protester_cover() {
-    game.cover_cycle_timer += GetFrameTime();
+void update_protester_cover(float dt) {
+    game.cover_cycle_timer += dt;
     if (game.cover_cycle_timer >= COVER_CYCLE_DURATION) {
         game.cover_cycle_timer = 0.0f;
         int active_protesters = 0;
-        for (int i = 0; i < MAX_PROTESTERS; i++) {
-            if (protesters[i].active && !protesters[i].is_player_controlled) active_protesters++;
+        for (int i = 0; i < protesters.count; i++) {
+            if (protesters.active[i] && !protesters.cold[i].is_player_controlled) active_protesters++;
         }
         int cover_count;
         switch (game.cover_cycle_phase) {
             case 0: cover_count = 8; break;
             case 1: cover_count = 13; break;
             case 2: cover_count = 3; break;
-            default: cover_count = (active_protesters > 0) ? (rand() % (active_protesters > 15 ? 15 : active_protesters)) + 3 : 0; break;
+            default: cover_count = (active_protesters > 0) ? rng_int(&game.rng, active_protesters > 15 ? 15 : active_protesters) + 3 : 0; break;
         }
         game.cover_cycle_phase = (game.cover_cycle_phase + 1) % 4;
-        for (int i = 0; i < MAX_PROTESTERS; i++) {
-            if (protesters[i].active && !protesters[i].is_player_controlled) {
-                protesters[i].is_taking_cover = false;
-                protesters[i].cover_barrier_id = -1;
+        int candidate_count = 0;
+        cover_candidates = resize_array(cover_candidates, protesters.count > 0 ? protesters.count : 1, sizeof(int));
+        for (int i = 0; i < protesters.count; i++) {
+            if (protesters.active[i] && !protesters.cold[i].is_player_controlled) {
+                protesters.taking_cover[i] = false;
+                protesters.cold[i].cover_slot = -1;
+                cover_candidates[candidate_count++] = i;
             }
         }
-        for (int i = 0; i < cover_count; i++) {
-            int index = rand() % MAX_PROTESTERS;
-            int attempts = 0;
-            while (attempts < MAX_PROTESTERS && 
-                   (!protesters[index].active || protesters[index].is_player_controlled || protesters[index].is_taking_cover)) {
-                index = (index + 1) % MAX_PROTESTERS;
-                attempts++;
-            }
-            if (attempts < MAX_PROTESTERS) {
-                protesters[index].is_taking_cover = true;
-                protesters[index].cover_barrier_id = find_nearest_barrier(protesters[index].position);
-                if (protesters[index].cover_barrier_id != -1) {
-                    protesters[index].ai_state = TAKING_COVER;
-                }
+        for (int i = 0; i < cover_slots.count; i++) cover_slots.reserved[i] = false;
+        // Partial Fisher-Yates: the first cover_count candidates end up a
+        // uniform pick without repeats.
+        for (int i = 0; i < cover_count && i < candidate_count; i++) {
+            int pick = i + rng_int(&game.rng, candidate_count - i);
+            int index = cover_candidates[pick];
+            cover_candidates[pick] = cover_candidates[i];
+            cover_candidates[i] = index;
+            protesters.taking_cover[index] = true;
+            int slot = find_free_cover_slot(store_position(&protesters, index));
+            protesters.cold[index].cover_slot = slot;
+            if (slot != -1) {
+                cover_slots.reserved[slot] = true;
+                UnitTally was = store_tally(&protesters, index);
+                protesters.ai_state[index] = TAKING_COVER;
+                recount_unit(&protester_counts, was, store_tally(&protesters, index));
             }
         }
     }
 }
 
+void apply_melee_hit(int target) {
+    if (!protesters.active[target]) return;
+    EntityCold *enemy = &protesters.cold[target];
+    enemy->melee_health -= 2;
+    enemy->animation_timer = ANIMATION_DURATION;
+    if (enemy->melee_health <= 0 || enemy->bullet_health <= 0) {
+        count_unit(&protester_counts, store_tally(&protesters, target), -1);
+        protesters.active[target] = false;
+        protester_density.valid = false;
+    }
+}
+
 void update_protester_combat(Entity *entity, float closest_dist, int closest_enemy, Vector2 target_pos) {
     entity->target_id = closest_enemy;
     if (closest_dist < STONE_RANGE && entity->cooldown <= 0 && has_clear_shot(entity->position, target_pos)) {
@@ -469,11 +2049,10 @@ void update_police_combat(Entity *entity, float closest_dist, int closest_enemy,
         if (closest_dist <= MELEE_RANGE) {
             entity->ai_state = ATTACKING;
             if (entity->cooldown <= 0) {
-                Entity *enemies = protesters;
-                enemies[closest_enemy].melee_health -= 2;
-                enemies[closest_enemy].animation_timer = ANIMATION_DURATION;
-                if (enemies[closest_enemy].melee_health <= 0 || enemies[closest_enemy].bullet_health <= 0) {
-                    enemies[closest_enemy].active = false;
+                if (entity->effects) {
+                    entity->effects->melee_target = closest_enemy;
+                } else {
+                    apply_melee_hit(closest_enemy);
                 }
                 entity->cooldown = POLICE_MELEE_COUNTDOWN;
             }
@@ -481,7 +2060,7 @@ void update_police_combat(Entity *entity, float closest_dist, int closest_enemy,
         } else {
             entity->ai_state = MOVING;
             Vector2 dense_area = find_densest_enemy_area(entity, POLICE);
-            float y_offset = (rand() % 2 == 0 ? 1 : -1) * FLANKING_OFFSET;
+            float y_offset = (rng_int(&entity->rng, 2) == 0 ? 1 : -1) * FLANKING_OFFSET;
             Vector2 flank_pos = {dense_area.x, dense_area.y + y_offset};
             Vector2 dir_flank = Vector2Subtract(flank_pos, entity->position);
             dir_flank = Vector2Normalize(dir_flank);
@@ -490,26 +2069,24 @@ void update_police_combat(Entity *entity, float closest_dist, int closest_enemy,
     }
 }
 
-void update_protester_ai(Entity *entity, int index) {
+void update_protester_ai(Entity *entity, int index, float dt) {
     if (!entity->active || entity->is_player_controlled) return;
-    if (entity->cooldown > 0) entity->cooldown -= GetFrameTime();
-    if (entity->animation_timer > 0) entity->animation_timer -= GetFrameTime();
+    if (entity->cooldown > 0) entity->cooldown -= dt;
+    if (entity->animation_timer > 0) entity->animation_timer -= dt;
     float closest_dist;
     int closest_enemy;
     Vector2 target_pos;
     find_closest_enemy(entity, PROTESTER, &closest_dist, &closest_enemy, &target_pos);
-    Vector2 police_territory_target = {PROTESTER_TERRITORY_X, entity->position.y};
-    if (entity->is_taking_cover && entity->cover_barrier_id != -1 && barriers[entity->cover_barrier_id].active) {
+    if (entity->is_taking_cover && entity->cover_slot != -1 && barriers[cover_slots.barrier[entity->cover_slot]].active) {
         entity->ai_state = TAKING_COVER;
-        Vector2 barrier_pos = {barriers[entity->cover_barrier_id].start.x, 
-                              (barriers[entity->cover_barrier_id].start.y + barriers[entity->cover_barrier_id].end.y) / 2};
-        float dist_to_cover = distance(entity->position, barrier_pos);
+        Vector2 cover_pos = cover_slots.pos[entity->cover_slot];
+        float dist_to_cover = distance(entity->position, cover_pos);
         if (dist_to_cover > 5.0f) {
-            Vector2 dir = Vector2Subtract(barrier_pos, entity->position);
+            Vector2 dir = Vector2Subtract(cover_pos, entity->position);
             dir = Vector2Normalize(dir);
             entity->velocity = Vector2Scale(dir, ENTITY_SPEED * entity->morale_boost);
         } else {
-            entity->position = barrier_pos;
+            entity->position = cover_pos;
             entity->velocity = (Vector2){0, 0};
             update_protester_combat(entity, closest_dist, closest_enemy, target_pos);
         }
@@ -518,9 +2095,7 @@ void update_protester_ai(Entity *entity, int index) {
         Vector2 center_dir = {0, SCREEN_HEIGHT / 2 - entity->position.y};
         center_dir = Vector2Normalize(center_dir);
         center_dir = Vector2Scale(center_dir, ENTITY_SPEED * 0.05f * entity->morale_boost);
-        Vector2 advance_dir = Vector2Subtract(police_territory_target, entity->position);
-        advance_dir = Vector2Normalize(advance_dir);
-        advance_dir = Vector2Scale(advance_dir, ENTITY_SPEED * 0.8f * entity->morale_boost);
+        Vector2 advance_dir = Vector2Scale(flow_direction(entity->position), ENTITY_SPEED * 0.8f * entity->morale_boost);
         if (health_ratio < RETREAT_HEALTH_THRESHOLD && closest_enemy != -1) {
             entity->ai_state = RETREATING;
             Vector2 dir = Vector2Subtract(entity->position, target_pos);
@@ -541,25 +2116,18 @@ void update_protester_ai(Entity *entity, int index) {
             entity->velocity = Vector2Add(entity->velocity, center_dir);
         }
     }
-    Vector2 avoidance = avoid_collisions(entity, index, protesters, MAX_PROTESTERS);
-    Vector2 flocking = compute_flocking(entity, index, protesters, MAX_PROTESTERS);
+    Vector2 avoidance = avoid_collisions(entity, index, &protesters, &protester_grid);
+    Vector2 flocking = compute_flocking(entity, index, &protesters, &protester_grid);
     entity->velocity = Vector2Add(entity->velocity, avoidance);
     entity->velocity = Vector2Add(entity->velocity, Vector2Scale(flocking, 0.3f));
     Vector2 prev_velocity = entity->velocity;
-    Vector2 new_pos = Vector2Add(entity->position, Vector2Scale(entity->velocity, GetFrameTime()));
-    bool collision = false;
-    for (int i = 0; i < MAX_BARRIERS; i++) {
-        if (barriers[i].active && point_near_line(new_pos, barriers[i].start, barriers[i].end, COVER_WIDTH)) {
-            collision = true;
-            break;
-        }
-    }
-    if (!collision) {
+    Vector2 new_pos = Vector2Add(entity->position, Vector2Scale(entity->velocity, dt));
+    if (!blocked_by_barrier(new_pos)) {
         entity->position = new_pos;
         entity->velocity = Vector2Add(Vector2Scale(entity->velocity, 0.7f), Vector2Scale(prev_velocity, 0.3f));
     } else {
         Vector2 dir = Vector2Normalize(Vector2Subtract(entity->position, (Vector2){new_pos.x, entity->position.y}));
-        entity->position = Vector2Add(entity->position, Vector2Scale(dir, 10.0f * GetFrameTime()));
+        entity->position = Vector2Add(entity->position, Vector2Scale(dir, 10.0f * dt));
         entity->velocity = Vector2Scale(dir, ENTITY_SPEED * entity->morale_boost);
     }
     if (entity->position.x < COVER_WIDTH) entity->position.x = COVER_WIDTH;
@@ -568,12 +2136,12 @@ void update_protester_ai(Entity *entity, int index) {
     if (entity->position.y > SCREEN_HEIGHT - COVER_HEIGHT / 2) entity->position.y = SCREEN_HEIGHT - COVER_HEIGHT / 2;
 }
 
-void update_police_ai(Entity *entity, int index) {
+void update_police_ai(Entity *entity, int index, float dt) {
     if (!entity->active) return;
-    if (entity->cooldown > 0) entity->cooldown -= GetFrameTime();
-    if (entity->animation_timer > 0) entity->animation_timer -= GetFrameTime();
+    if (entity->cooldown > 0) entity->cooldown -= dt;
+    if (entity->animation_timer > 0) entity->animation_timer -= dt;
     if (entity->ai_state == DYING) {
-        entity->position.y += 200.0f * GetFrameTime();
+        entity->position.y += 200.0f * dt;
         if (entity->animation_timer <= 0) {
             entity->active = false;
         }
@@ -581,11 +2149,11 @@ void update_police_ai(Entity *entity, int index) {
     }
     if (entity->police_type == HELICOPTER) {
         if (entity->wander_timer <= 0 || distance(entity->position, entity->wander_target) < 20.0f) {
-            entity->wander_target.x = 600 + (rand() % (SCREEN_WIDTH - 600));
-            entity->wander_target.y = 50 + (rand() % (SCREEN_HEIGHT - 100));
-            entity->wander_timer = 3.0f + ((float)rand() / RAND_MAX) * 4.0f;
+            entity->wander_target.x = 600 + rng_int(&entity->rng, SCREEN_WIDTH - 600);
+            entity->wander_target.y = 50 + rng_int(&entity->rng, SCREEN_HEIGHT - 100);
+            entity->wander_timer = 3.0f + rng_float(&entity->rng) * 4.0f;
         }
-        entity->wander_timer -= GetFrameTime();
+        entity->wander_timer -= dt;
         Vector2 dir = Vector2Subtract(entity->wander_target, entity->position);
         if (Vector2Length(dir) > 0) {
             dir = Vector2Normalize(dir);
@@ -605,7 +2173,7 @@ void update_police_ai(Entity *entity, int index) {
             entity->cooldown = HELICOPTER_COOLDOWN;
             entity->animation_timer = ANIMATION_DURATION;
         }
-        Vector2 new_pos = Vector2Add(entity->position, Vector2Scale(entity->velocity, GetFrameTime()));
+        Vector2 new_pos = Vector2Add(entity->position, Vector2Scale(entity->velocity, dt));
         entity->position = new_pos;
         if (entity->position.x < 0) entity->position.x = 0;
         if (entity->position.x > SCREEN_WIDTH) entity->position.x = SCREEN_WIDTH;
@@ -627,25 +2195,18 @@ void update_police_ai(Entity *entity, int index) {
         entity->velocity = (entity->police_type == SHOOTER) ? (Vector2){0, 0} : 
                            Vector2Scale(dir, ENTITY_SPEED * entity->morale_boost);
     }
-    Vector2 avoidance = avoid_collisions(entity, index, police, MAX_POLICE);
-    Vector2 flocking = compute_flocking(entity, index, police, MAX_POLICE);
+    Vector2 avoidance = avoid_collisions(entity, index, &police, &police_grid);
+    Vector2 flocking = compute_flocking(entity, index, &police, &police_grid);
     entity->velocity = Vector2Add(entity->velocity, avoidance);
     entity->velocity = Vector2Add(entity->velocity, flocking);
     Vector2 prev_velocity = entity->velocity;
-    Vector2 new_pos = Vector2Add(entity->position, Vector2Scale(entity->velocity, GetFrameTime()));
-    bool collision = false;
-    for (int i = 0; i < MAX_BARRIERS; i++) {
-        if (barriers[i].active && point_near_line(new_pos, barriers[i].start, barriers[i].end, COVER_WIDTH)) {
-            collision = true;
-            break;
-        }
-    }
-    if (!collision) {
+    Vector2 new_pos = Vector2Add(entity->position, Vector2Scale(entity->velocity, dt));
+    if (!blocked_by_barrier(new_pos)) {
         entity->position = new_pos;
         entity->velocity = Vector2Add(Vector2Scale(entity->velocity, 0.7f), Vector2Scale(prev_velocity, 0.3f));
     } else {
         Vector2 dir = Vector2Normalize(Vector2Subtract(entity->position, (Vector2){new_pos.x, entity->position.y}));
-        entity->position = Vector2Add(entity->position, Vector2Scale(dir, 10.0f * GetFrameTime()));
+        entity->position = Vector2Add(entity->position, Vector2Scale(dir, 10.0f * dt));
         entity->velocity = Vector2Scale(dir, ENTITY_SPEED * entity->morale_boost);
     }
     if (entity->position.x < COVER_WIDTH) entity->position.x = COVER_WIDTH;
@@ -654,108 +2215,267 @@ void update_police_ai(Entity *entity, int index) {
     if (entity->position.y > SCREEN_HEIGHT - COVER_HEIGHT / 2) entity->position.y = SCREEN_HEIGHT - COVER_HEIGHT / 2;
 }
 
-void update_player_controlled(Entity *entity) {
+void update_player_controlled(Entity *entity, float dt, const PlayerInput *input) {
     if (!entity->active) return;
     entity->velocity = (Vector2){0, 0};
     float speed = ENTITY_SPEED * entity->morale_boost;
-    if (IsKeyDown(KEY_W)) entity->velocity.y -= speed;
-    if (IsKeyDown(KEY_S)) entity->velocity.y += speed;
-    if (IsKeyDown(KEY_A)) entity->velocity.x -= speed;
-    if (IsKeyDown(KEY_D)) entity->velocity.x += speed;
-    Vector2 new_pos = Vector2Add(entity->position, Vector2Scale(entity->velocity, GetFrameTime()));
-    bool collision = false;
-    for (int i = 0; i < MAX_BARRIERS; i++) {
-        if (barriers[i].active && point_near_line(new_pos, barriers[i].start, barriers[i].end, COVER_WIDTH)) {
-            collision = true;
-            break;
-        }
-    }
-    if (!collision) {
+    if (input->move_up) entity->velocity.y -= speed;
+    if (input->move_down) entity->velocity.y += speed;
+    if (input->move_left) entity->velocity.x -= speed;
+    if (input->move_right) entity->velocity.x += speed;
+    Vector2 new_pos = Vector2Add(entity->position, Vector2Scale(entity->velocity, dt));
+    if (!blocked_by_barrier(new_pos)) {
         entity->position = new_pos;
     }
     if (entity->position.x < COVER_WIDTH) entity->position.x = COVER_WIDTH;
     if (entity->position.x > SCREEN_WIDTH - COVER_WIDTH) entity->position.x = SCREEN_WIDTH - COVER_WIDTH;
     if (entity->position.y < COVER_HEIGHT / 2) entity->position.y = COVER_HEIGHT / 2;
     if (entity->position.y > SCREEN_HEIGHT - COVER_HEIGHT / 2) entity->position.y = SCREEN_HEIGHT - COVER_HEIGHT / 2;
-    if (entity->cooldown > 0) entity->cooldown -= GetFrameTime();
-    if (entity->animation_timer > 0) entity->animation_timer -= GetFrameTime();
-    if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT) && entity->cooldown <= 0) {
-        Vector2 mouse_pos = GetMousePosition();
+    if (entity->cooldown > 0) entity->cooldown -= dt;
+    if (entity->animation_timer > 0) entity->animation_timer -= dt;
+    if (input->fire && entity->cooldown <= 0) {
+        Vector2 mouse_pos = input->mouse_pos;
         Vector2 dir = {mouse_pos.x - entity->position.x, mouse_pos.y - entity->position.y};
         fire_projectile(entity->position, dir, entity->type, entity);
         entity->cooldown = PROTESTER_COUNTDOWN;
     }
 }
 
-void update_projectiles() {
-    for (int i = 0; i < MAX_PROJECTILES; i++) {
-        if (projectiles[i].active) {
-            projectiles[i].position.x += projectiles[i].velocity.x * GetFrameTime();
-            projectiles[i].position.y += projectiles[i].velocity.y * GetFrameTime();
-            projectiles[i].distance_traveled += Vector2Length(projectiles[i].velocity) * GetFrameTime();
-            if (projectiles[i].distance_traveled > (projectiles[i].type == PROTESTER ? STONE_RANGE : BULLET_RANGE)) {
-                projectiles[i].active = false;
-                continue;
-            }
-            for (int j = 0; j < MAX_BARRIERS; j++) {
-                if (barriers[j].active && point_near_line(projectiles[i].position, barriers[j].start, barriers[j].end, COVER_WIDTH)) {
-                    projectiles[i].active = false;
-                    break;
+// Lowest-index active target within HIT_RADIUS of pos, or -1. Only the grid
+// cells around pos are visited; picking the lowest index keeps the outcome
+// the same as the old scan over the whole team in index order.
+int find_hit_target(const EntityStore *targets, const SpatialGrid *grid, Vector2 pos) {
+    int hit = -1;
+    int cx0, cy0, cx1, cy1;
+    grid_query_bounds(pos, HIT_RADIUS, &cx0, &cy0, &cx1, &cy1);
+    for (int cy = cy0; cy <= cy1; cy++) {
+        for (int cx = cx0; cx <= cx1; cx++) {
+            int c = cy * GRID_COLS + cx;
+            for (int k = grid->cell_start[c]; k < grid->cell_start[c + 1]; k++) {
+                int j = grid->entries[k];
+                if ((hit == -1 || j < hit) && targets->active[j] &&
+                    distance(pos, store_position(targets, j)) < HIT_RADIUS) {
+                    hit = j;
                 }
             }
-            if (!projectiles[i].active) continue;
-            Entity *targets = (projectiles[i].type == PROTESTER) ? police : protesters;
-            int max_targets = (projectiles[i].type == PROTESTER) ? MAX_POLICE : MAX_PROTESTERS;
-            for (int j = 0; j < max_targets; j++) {
-                if (targets[j].active) {
-                    float dist = distance(projectiles[i].position, targets[j].position);
-                    if (dist < 10.0f) {
-                        targets[j].bullet_health -= (projectiles[i].type == PROTESTER) ? 2 : 1;
-                        targets[j].animation_timer = ANIMATION_DURATION;
-                        if (targets[j].bullet_health <= 0 || (targets[j].type == PROTESTER && targets[j].melee_health <= 0)) {
-                            if (targets[j].type == POLICE && targets[j].police_type == HELICOPTER) {
-                                targets[j].ai_state = DYING;
-                                targets[j].animation_timer = DYING_DURATION;
-                                targets[j].velocity = (Vector2){0, 200.0f};
-                            } else {
-                                targets[j].active = false;
-                            }
-                        }
-                        projectiles[i].active = false;
-                        break;
-                    }
+        }
+    }
+    return hit;
+}
+
+// Earliest t in [0, 1] at which p0 + t * (p1 - p0) is within radius of
+// center. Returns false if the segment never gets that close.
+bool sweep_circle(Vector2 p0, Vector2 p1, Vector2 center, float radius, float *t) {
+    Vector2 d = Vector2Subtract(p1, p0);
+    Vector2 m = Vector2Subtract(p0, center);
+    float c = m.x * m.x + m.y * m.y - radius * radius;
+    if (c < 0) {
+        *t = 0;
+        return true;
+    }
+    float a = d.x * d.x + d.y * d.y;
+    float b = m.x * d.x + m.y * d.y;
+    if (a == 0 || b >= 0) return false;
+    float disc = b * b - a * c;
+    if (disc < 0) return false;
+    float hit = (-b - sqrtf(disc)) / a;
+    if (hit > 1) return false;
+    *t = hit;
+    return true;
+}
+
+// Same as sweep_circle for the capsule of the given radius around the
+// segment a-b, i.e. the region point_near_line(point, a, b, radius) accepts:
+// the two end caps plus the two sides of the slab between them.
+bool sweep_capsule(Vector2 p0, Vector2 p1, Vector2 a, Vector2 b, float radius, float *t) {
+    Vector2 ab = Vector2Subtract(b, a);
+    float len = Vector2Length(ab);
+    if (len == 0) return false;
+    float best = 2.0f;
+    float hit;
+    if (sweep_circle(p0, p1, a, radius, &hit) && hit < best) best = hit;
+    if (sweep_circle(p0, p1, b, radius, &hit) && hit < best) best = hit;
+    Vector2 n = {-ab.y / len, ab.x / len};
+    Vector2 d = Vector2Subtract(p1, p0);
+    float s0 = (p0.x - a.x) * n.x + (p0.y - a.y) * n.y;
+    float ds = d.x * n.x + d.y * n.y;
+    if (ds != 0) {
+        for (int side = -1; side <= 1; side += 2) {
+            hit = (side * radius - s0) / ds;
+            if (hit >= 0 && hit < best) {
+                Vector2 q = {p0.x + hit * d.x, p0.y + hit * d.y};
+                float u = ((q.x - a.x) * ab.x + (q.y - a.y) * ab.y) / (len * len);
+                if (u >= 0 && u <= 1) best = hit;
+            }
+        }
+    }
+    if (best > 1) return false;
+    *t = best;
+    return true;
+}
+
+// Earliest barrier crossed by the segment p0-p1 before max_t. A barrier that
+// already contains p0 is skipped: that only happens for a shot fired from
+// cover, which the end-point test let through as well.
+typedef struct {
+    Vector2 p0;
+    Vector2 p1;
+    float max_t;
+    bool found;
+} BarrierSweep;
+
+bool sweep_barrier(void *ctx, int j) {
+    BarrierSweep *sweep = ctx;
+    if (!barriers[j].active || point_near_line(sweep->p0, barriers[j].start, barriers[j].end, COVER_WIDTH)) return true;
+    float hit;
+    if (sweep_capsule(sweep->p0, sweep->p1, barriers[j].start, barriers[j].end, COVER_WIDTH, &hit) && hit <= sweep->max_t) {
+        sweep->max_t = hit;
+        sweep->found = true;
+    }
+    return true;
+}
+
+bool sweep_barriers(Vector2 p0, Vector2 p1, float max_t, float *t) {
+    BarrierSweep sweep = {p0, p1, max_t, false};
+    visit_barriers_along(p0, p1, sweep_barrier, &sweep);
+    if (sweep.found) *t = sweep.max_t;
+    return sweep.found;
+}
+
+// First target whose hit circle the segment p0-p1 enters before max_t (ties
+// go to the lower index), or -1. Visits the grid cells around the segment.
+int find_swept_target(const EntityStore *targets, const SpatialGrid *grid, Vector2 p0, Vector2 p1, float max_t, float *hit_t) {
+    int hit = -1;
+    float best = max_t;
+    int cx0 = grid_coord(fminf(p0.x, p1.x) - HIT_RADIUS, GRID_COLS);
+    int cx1 = grid_coord(fmaxf(p0.x, p1.x) + HIT_RADIUS, GRID_COLS);
+    int cy0 = grid_coord(fminf(p0.y, p1.y) - HIT_RADIUS, GRID_ROWS);
+    int cy1 = grid_coord(fmaxf(p0.y, p1.y) + HIT_RADIUS, GRID_ROWS);
+    for (int cy = cy0; cy <= cy1; cy++) {
+        for (int cx = cx0; cx <= cx1; cx++) {
+            int c = cy * GRID_COLS + cx;
+            for (int k = grid->cell_start[c]; k < grid->cell_start[c + 1]; k++) {
+                int j = grid->entries[k];
+                float t;
+                if (targets->active[j] && sweep_circle(p0, p1, store_position(targets, j), HIT_RADIUS, &t) &&
+                    (t < best || (t == best && (hit == -1 || j < hit)))) {
+                    best = t;
+                    hit = j;
                 }
             }
         }
     }
+    *hit_t = best;
+    return hit;
 }
 
-void check_game_conditions() {
-    bool helicopter_alive = false;
-    for (int i = 0; i < MAX_POLICE; i++) {
-        if (police[i].active && police[i].police_type == HELICOPTER && police[i].ai_state != DYING) {
-            helicopter_alive = true;
-            break;
+void apply_projectile_hit(EntityStore *targets, int j, EntityType projectile_type) {
+    EntityCold *target = &targets->cold[j];
+    target->bullet_health -= (projectile_type == PROTESTER) ? 2 : 1;
+    target->animation_timer = ANIMATION_DURATION;
+    if (target->bullet_health <= 0 || (target->type == PROTESTER && target->melee_health <= 0)) {
+        TeamCounts *counts = team_counts(target->type);
+        UnitTally was = store_tally(targets, j);
+        if (target->type == POLICE && target->police_type == HELICOPTER) {
+            targets->ai_state[j] = DYING;
+            target->animation_timer = DYING_DURATION;
+            targets->vel_x[j] = 0;
+            targets->vel_y[j] = 200.0f;
+        } else {
+            targets->active[j] = false;
         }
+        recount_unit(counts, was, store_tally(targets, j));
     }
-    if (!helicopter_alive) {
-        game.state = PROTESTER_WIN;
-        return;
+}
+
+// Movement, range and barriers for one projectile. It touches nothing but
+// the projectile and its step, so projectiles already in flight are
+// integrated while the AI runs.
+void integrate_projectile(int slot, float dt) {
+    Projectile *projectile = &projectiles[slot];
+    ProjectileStep *result = &projectile_steps[slot];
+    float range = projectile->type == PROTESTER ? STONE_RANGE : BULLET_RANGE;
+    Vector2 start = projectile->position;
+    float step = Vector2Length(projectile->velocity) * dt;
+    projectile->position.x += projectile->velocity.x * dt;
+    projectile->position.y += projectile->velocity.y * dt;
+    result->start = start;
+    result->blocked = false;
+    if (config.swept_projectiles) {
+        // Only the part of the step that is still within range counts.
+        float reach = 1.0f;
+        if (projectile->distance_traveled + step > range) {
+            reach = step > 0 ? (range - projectile->distance_traveled) / step : 0.0f;
+        }
+        result->barrier_t = reach;
+        result->blocked = sweep_barriers(start, projectile->position, reach, &result->barrier_t);
+        projectile->distance_traveled += step;
+        result->expired = result->blocked || projectile->distance_traveled > range;
+    } else {
+        projectile->distance_traveled += step;
+        result->expired = projectile->distance_traveled > range || blocked_by_barrier(projectile->position);
     }
-    int active_protesters = 0;
-    int protesters_in_territory = 0;
-    for (int i = 0; i < MAX_PROTESTERS; i++) {
-        if (protesters[i].active) {
-            active_protesters++;
-            if (distance(protesters[i].position, (Vector2){PROTESTER_TERRITORY_X, protesters[i].position.y}) < TERRITORY_RANGE) {
-                protesters_in_territory++;
-            }
+}
+
+// Target hits in live-list order, once every projectile is integrated and the
+// grids hold the post-movement positions. Hits change who is still there to
+// be hit, so this part stays serial.
+// Slots survive a tick in slot order and the ones fired during it come off
+// the heap in ascending order, so the live list is two sorted runs.
+void sort_live_projectiles(int in_flight) {
+    ProjectilePool *pool = &projectile_pool;
+    int a = 0, b = in_flight, n = 0;
+    while (a < in_flight || b < pool->live_count) {
+        bool take_a = b == pool->live_count || (a < in_flight && pool->live[a] < pool->live[b]);
+        pool->merged[n++] = pool->live[take_a ? a++ : b++];
+    }
+    for (int k = 0; k < n; k++) {
+        pool->live[k] = pool->merged[k];
+        pool->live_index[pool->live[k]] = k;
+    }
+}
+
+void resolve_projectiles(int in_flight) {
+    ProjectilePool *pool = &projectile_pool;
+    sort_live_projectiles(in_flight);
+    int kept = 0;
+    for (int k = 0; k < pool->live_count; k++) {
+        int slot = pool->live[k];
+        Projectile *projectile = &projectiles[slot];
+        const ProjectileStep *step = &projectile_steps[slot];
+        EntityStore *targets = (projectile->type == PROTESTER) ? &police : &protesters;
+        const SpatialGrid *grid = (projectile->type == PROTESTER) ? &police_grid : &protester_grid;
+        bool expired = step->expired;
+        int hit = -1;
+        if (config.swept_projectiles) {
+            float hit_t;
+            hit = find_swept_target(targets, grid, step->start, projectile->position, step->barrier_t, &hit_t);
+            if (step->blocked && hit != -1 && hit_t >= step->barrier_t) hit = -1;
+        } else if (!expired) {
+            hit = find_hit_target(targets, grid, projectile->position);
+        }
+        if (hit != -1) {
+            apply_projectile_hit(targets, hit, projectile->type);
+            expired = true;
+        }
+        if (expired) {
+            release_projectile(slot);
+        } else {
+            pool->live[kept] = slot;
+            pool->live_index[slot] = kept++;
         }
     }
-    int active_police = 0;
-    for (int i = 0; i < MAX_POLICE; i++) {
-        if (police[i].active && police[i].ai_state != DYING) active_police++;
+    pool->live_count = kept;
+}
+
+void check_game_conditions(float dt) {
+    if (atomic_load(&police_counts.fighting[HELICOPTER]) == 0) {
+        game.state = PROTESTER_WIN;
+        return;
     }
+    int active_protesters = atomic_load(&protester_counts.active);
+    int protesters_in_territory = atomic_load(&protester_counts.in_territory);
+    int active_police = fighting_units(&police_counts);
     if (active_protesters == 0) {
         game.state = POLICE_WIN;
         return;
@@ -765,7 +2485,7 @@ void check_game_conditions() {
         return;
     }
     if (protesters_in_territory > 0) {
-        game.territory_hold_timer += GetFrameTime();
+        game.territory_hold_timer += dt;
         if (game.territory_hold_timer >= WIN_HOLD_TIME) {
             game.state = PROTESTER_WIN;
         }
@@ -774,12 +2494,53 @@ void check_game_conditions() {
     }
 }
 
+#ifndef HEADLESS
+// Unit bodies, health bars and projectiles are written straight into rlgl's
+// vertex batch as triangles, between one rlBegin/rlEnd pair per layer. The
+// per-unit shape calls each rebuilt the circle with sinf/cosf and switched
+// between triangle and quad mode, which split the batch into a draw call or
+// two per unit. Shapes match what DrawCircleV and DrawRectangle produce.
+#define CIRCLE_SEGMENTS 36
+
+Vector2 circle_unit[CIRCLE_SEGMENTS + 1];
+
+void init_circle_unit() {
+    for (int k = 0; k <= CIRCLE_SEGMENTS; k++) {
+        float a = DEG2RAD * (360.0f / CIRCLE_SEGMENTS) * k;
+        circle_unit[k] = (Vector2){cosf(a), sinf(a)};
+    }
+}
+
+void batch_circle(Vector2 center, float radius, Color c) {
+    rlCheckRenderBatchLimit(3 * CIRCLE_SEGMENTS);
+    rlColor4ub(c.r, c.g, c.b, c.a);
+    for (int k = 0; k < CIRCLE_SEGMENTS; k++) {
+        rlVertex2f(center.x, center.y);
+        rlVertex2f(center.x + circle_unit[k + 1].x * radius, center.y + circle_unit[k + 1].y * radius);
+        rlVertex2f(center.x + circle_unit[k].x * radius, center.y + circle_unit[k].y * radius);
+    }
+}
+
+void batch_rectangle(float x, float y, float width, float height, Color c) {
+    rlCheckRenderBatchLimit(6);
+    rlColor4ub(c.r, c.g, c.b, c.a);
+    rlVertex2f(x, y);
+    rlVertex2f(x, y + height);
+    rlVertex2f(x + width, y);
+    rlVertex2f(x + width, y);
+    rlVertex2f(x, y + height);
+    rlVertex2f(x + width, y + height);
+}
+
+// Needs an open RL_TRIANGLES block. Snaps to whole pixels like DrawRectangle.
 void draw_health_bar(Vector2 pos, int health, int max_health, Color c) {
     float width = 20.0f;
     float height = 4.0f;
     float health_ratio = (float)health / max_health;
-    DrawRectangle(pos.x - width / 2, pos.y - 15, width, height, BLACK);
-    DrawRectangle(pos.x - width / 2, pos.y - 15, width * health_ratio, height, c);
+    int x = pos.x - width / 2;
+    int y = pos.y - 15;
+    batch_rectangle(x, y, (int)width, (int)height, BLACK);
+    batch_rectangle(x, y, (int)(width * health_ratio), (int)height, c);
 }
 
 void draw_background() {
@@ -794,7 +2555,7 @@ void draw_background() {
 }
 
 void draw_barriers() {
-    for (int i = 0; i < MAX_BARRIERS; i++) {
+    for (int i = 0; i < barrier_count; i++) {
         if (barriers[i].active) {
             Color c = (barriers[i].type == CAR) ? RED : GREEN;
             DrawLineEx(barriers[i].start, barriers[i].end, 4.0f, c);
@@ -802,97 +2563,133 @@ void draw_barriers() {
     }
 }
 
+// Background and barriers only change when the barrier layout does, so they
+// are drawn once into a texture and copied to the screen each frame.
+RenderTexture2D static_layer = {0};
+int static_layer_version = -1;
+
+void draw_static_layer() {
+    if (static_layer.id == 0) static_layer = LoadRenderTexture(SCREEN_WIDTH, SCREEN_HEIGHT);
+    if (static_layer_version != barrier_version) {
+        BeginTextureMode(static_layer);
+        ClearBackground(GRAY);
+        draw_background();
+        draw_barriers();
+        EndTextureMode();
+        static_layer_version = barrier_version;
+    }
+    // Copy the texels as they are: blending the faded grid a second time
+    // would darken it. Render textures are stored upside down.
+    rlSetBlendFactors(RL_ONE, RL_ZERO, RL_FUNC_ADD);
+    BeginBlendMode(BLEND_CUSTOM);
+    DrawTextureRec(static_layer.texture, (Rectangle){0, 0, SCREEN_WIDTH, -SCREEN_HEIGHT}, (Vector2){0, 0}, WHITE);
+    EndBlendMode();
+}
+
+void draw_helicopter(int i) {
+    const EntityCold *cold = &police.cold[i];
+    Vector2 pos = store_position(&police, i);
+    if (police.ai_state[i] == DYING) {
+        for (int k = 0; k < 5; k++) {
+            float offset_x = sinf(GetTime() * 10 + k) * 10.0f;
+            float offset_y = cosf(GetTime() * 10 + k) * 10.0f;
+            Vector2 exp_pos = {pos.x + offset_x, pos.y + offset_y};
+            float exp_size = 15.0f * (1.0f - cold->animation_timer / DYING_DURATION);
+            DrawCircleV(exp_pos, exp_size, ORANGE);
+        }
+    }
+    DrawRectangleRounded((Rectangle){pos.x - 30, pos.y - 10, 60, 20}, 0.5, 10, BLUE);
+    DrawRectangle(pos.x + 30, pos.y - 3, 25, 5, BLUE);
+    float tail_angle = GetTime() * 720;
+    Vector2 tail_center = {pos.x + 50, pos.y};
+    for (int k = 0; k < 2; k++) {
+        float a = tail_angle + k * 180;
+        Vector2 end = {tail_center.x + cosf(a * DEG2RAD) * 7, tail_center.y + sinf(a * DEG2RAD) * 7};
+        DrawLineV(tail_center, end, BLACK);
+    }
+    Vector2 rotor_center = {pos.x, pos.y};
+    float rotor_angle = GetTime() * 360;
+    DrawCircle(rotor_center.x, rotor_center.y, 4, GRAY);
+    for (int k = 0; k < 4; k++) {
+        float a = rotor_angle + k * 90;
+        Vector2 end = {rotor_center.x + cosf(a * DEG2RAD) * 35, rotor_center.y + sinf(a * DEG2RAD) * 35};
+        DrawLineEx(rotor_center, end, 3, BLACK);
+    }
+    DrawRectangle(pos.x - 28, pos.y - 8, 8, 8, YELLOW);
+    DrawRectangle(pos.x - 28, pos.y, 8, 8, YELLOW);
+    if (police.ai_state[i] != DYING) {
+        rlBegin(RL_TRIANGLES);
+        draw_health_bar((Vector2){pos.x, pos.y + 20}, cold->bullet_health, HELICOPTER_HEALTH, GREEN);
+        rlEnd();
+    }
+}
+
+// Bodies and bars first as one batch, then the few markers and the
+// helicopter, which draw through the regular shape and text calls.
 void draw_entities() {
-    for (int i = 0; i < MAX_PROTESTERS; i++) {
-        if (protesters[i].active) {
-            float scale = 1.0f + 0.2f * (protesters[i].animation_timer / ANIMATION_DURATION);
-            DrawCircleV(protesters[i].position, 10.0f * scale, RED);
-            draw_health_bar(protesters[i].position, protesters[i].bullet_health, PROTESTER_BULLET_HEALTH, GREEN);
-            if (i == selected_entity && selected_type == PROTESTER) {
-                DrawCircleLines(protesters[i].position.x, protesters[i].position.y, 12.0f * scale, BLACK);
+    rlBegin(RL_TRIANGLES);
+    for (int i = 0; i < protesters.count; i++) {
+        if (protesters.active[i]) {
+            const EntityCold *cold = &protesters.cold[i];
+            Vector2 pos = store_position(&protesters, i);
+            float scale = 1.0f + 0.2f * (cold->animation_timer / ANIMATION_DURATION);
+            batch_circle(pos, 10.0f * scale, RED);
+            draw_health_bar(pos, cold->bullet_health, PROTESTER_BULLET_HEALTH, GREEN);
+        }
+    }
+    int helicopter = -1;
+    for (int i = 0; i < police.count; i++) {
+        if (police.active[i]) {
+            const EntityCold *cold = &police.cold[i];
+            Vector2 pos = store_position(&police, i);
+            float scale = 1.0f + 0.2f * (cold->animation_timer / ANIMATION_DURATION);
+            if (cold->police_type == HELICOPTER) {
+                helicopter = i;
+                continue;
             }
-            if (protesters[i].is_taking_cover) {
-                DrawText("C", protesters[i].position.x - 5, protesters[i].position.y - 25, 10, BLACK);
+            if (cold->police_type == SHOOTER) {
+                batch_circle(pos, 10.0f * scale, BLUE);
+            } else {
+                batch_rectangle(pos.x - 10.0f * scale, pos.y - 10.0f * scale, 20.0f * scale, 20.0f * scale, BLUE);
             }
+            draw_health_bar(pos, cold->bullet_health, POLICE_HEALTH, GREEN);
         }
     }
-    for (int i = 0; i < MAX_POLICE; i++) {
-        if (police[i].active) {
-            float scale = 1.0f + 0.2f * (police[i].animation_timer / ANIMATION_DURATION);
-            if (police[i].police_type == HELICOPTER) {
-                Vector2 pos = police[i].position;
-                if (police[i].ai_state == DYING) {
-                    for (int k = 0; k < 5; k++) {
-                        float offset_x = sinf(GetTime() * 10 + k) * 10.0f;
-                        float offset_y = cosf(GetTime() * 10 + k) * 10.0f;
-                        Vector2 exp_pos = {pos.x + offset_x, pos.y + offset_y};
-                        float exp_size = 15.0f * (1.0f - police[i].animation_timer / DYING_DURATION);
-                        DrawCircleV(exp_pos, exp_size, ORANGE);
-                    }
-                }
-                DrawRectangleRounded((Rectangle){pos.x - 30, pos.y - 10, 60, 20}, 0.5, 10, BLUE);
-                DrawRectangle(pos.x + 30, pos.y - 3, 25, 5, BLUE);
-                float tail_angle = GetTime() * 720;
-                Vector2 tail_center = {pos.x + 50, pos.y};
-                for (int k = 0; k < 2; k++) {
-                    float a = tail_angle + k * 180;
-                    Vector2 end = {tail_center.x + cosf(a * DEG2RAD) * 7, tail_center.y + sinf(a * DEG2RAD) * 7};
-                    DrawLineV(tail_center, end, BLACK);
-                }
-                Vector2 rotor_center = {pos.x, pos.y};
-                float rotor_angle = GetTime() * 360;
-                DrawCircle(rotor_center.x, rotor_center.y, 4, GRAY);
-                for (int k = 0; k < 4; k++) {
-                    float a = rotor_angle + k * 90;
-                    Vector2 end = {rotor_center.x + cosf(a * DEG2RAD) * 35, rotor_center.y + sinf(a * DEG2RAD) * 35};
-                    DrawLineEx(rotor_center, end, 3, BLACK);
-                }
-                DrawRectangle(pos.x - 28, pos.y - 8, 8, 8, YELLOW);
-                DrawRectangle(pos.x - 28, pos.y, 8, 8, YELLOW);
-                if (police[i].ai_state != DYING) {
-                    draw_health_bar((Vector2){pos.x, pos.y + 20}, police[i].bullet_health, HELICOPTER_HEALTH, GREEN);
-                }
-            } else if (police[i].police_type == SHOOTER) {
-                DrawCircleV(police[i].position, 10.0f * scale, BLUE);
-                draw_health_bar(police[i].position, police[i].bullet_health, POLICE_HEALTH, GREEN);
-            } else {
-                DrawRectangleV(Vector2Subtract(police[i].position, (Vector2){10.0f * scale, 10.0f * scale}), 
-                               (Vector2){20.0f * scale, 20.0f * scale}, BLUE);
-                draw_health_bar(police[i].position, police[i].bullet_health, POLICE_HEALTH, GREEN);
+    rlEnd();
+    for (int i = 0; i < protesters.count; i++) {
+        if (protesters.active[i]) {
+            Vector2 pos = store_position(&protesters, i);
+            if (i == selected_entity && selected_type == PROTESTER) {
+                float scale = 1.0f + 0.2f * (protesters.cold[i].animation_timer / ANIMATION_DURATION);
+                DrawCircleLines(pos.x, pos.y, 12.0f * scale, BLACK);
+            }
+            if (protesters.taking_cover[i]) {
+                DrawText("C", pos.x - 5, pos.y - 25, 10, BLACK);
             }
         }
     }
+    if (helicopter != -1) draw_helicopter(helicopter);
 }
 
 void draw_projectiles() {
-    for (int i = 0; i < MAX_PROJECTILES; i++) {
-        if (projectiles[i].active) {
-            DrawCircleV(projectiles[i].position, 3.0f, projectiles[i].type == PROTESTER ? BROWN : WHITE);
-        }
+    rlBegin(RL_TRIANGLES);
+    for (int k = 0; k < projectile_pool.live_count; k++) {
+        const Projectile *projectile = &projectiles[projectile_pool.live[k]];
+        batch_circle(projectile->position, 3.0f, projectile->type == PROTESTER ? BROWN : WHITE);
     }
+    rlEnd();
 }
 
 void draw_ui() {
     char hold_time_text[32];
     snprintf(hold_time_text, sizeof(hold_time_text), "Territory Hold: %.1fs / %.1fs", game.territory_hold_timer, WIN_HOLD_TIME);
     DrawText(hold_time_text, 10, 40, 20, BLACK);
-    int active_protesters = 0, active_police = 0;
-    int attacking_protesters = 0, retreating_protesters = 0, cover_protesters = 0;
-    int attacking_police = 0;
-    for (int i = 0; i < MAX_PROTESTERS; i++) {
-        if (protesters[i].active) {
-            active_protesters++;
-            if (protesters[i].ai_state == ATTACKING) attacking_protesters++;
-            if (protesters[i].ai_state == RETREATING) retreating_protesters++;
-            if (protesters[i].ai_state == TAKING_COVER) cover_protesters++;
-        }
-    }
-    for (int i = 0; i < MAX_POLICE; i++) {
-        if (police[i].active && police[i].ai_state != DYING) {
-            active_police++;
-            if (police[i].ai_state == ATTACKING) attacking_police++;
-        }
-    }
+    int active_protesters = atomic_load(&protester_counts.active);
+    int attacking_protesters = atomic_load(&protester_counts.state[ATTACKING]);
+    int retreating_protesters = atomic_load(&protester_counts.state[RETREATING]);
+    int cover_protesters = atomic_load(&protester_counts.state[TAKING_COVER]);
+    int active_police = fighting_units(&police_counts);
+    int attacking_police = atomic_load(&police_counts.state[ATTACKING]);
     char count_text[80];
     snprintf(count_text, sizeof(count_text), 
              "Protesters: %d (Attack: %d, Retreat: %d, Cover: %d) | Police: %d (Attack: %d)", 
@@ -920,94 +2717,1265 @@ void draw_end_screen() {
     DrawText(message, SCREEN_WIDTH / 2 - MeasureText(message, 40) / 2, SCREEN_HEIGHT / 2 - 100, 40, BLACK);
     DrawText("Press SPACE to Restart", SCREEN_WIDTH / 2 - MeasureText("Press SPACE to Restart", 20) / 2, SCREEN_HEIGHT / 2, 20, BLACK);
 }
+#endif
 
-void handle_selection() {
-    if (IsMouseButtonPressed(MOUSE_BUTTON_RIGHT)) {
-        Vector2 mouse_pos = GetMousePosition();
-        float closest_dist = 50.0f;
-        int closest_entity = -1;
-        EntityType closest_type = PROTESTER;
-        for (int i = 0; i < MAX_PROTESTERS; i++) {
-            if (protesters[i].active) {
-                float dist = distance(mouse_pos, protesters[i].position);
-                if (dist < closest_dist) {
-                    closest_dist = dist;
-                    closest_entity = i;
-                    closest_type = PROTESTER;
-                }
-            }
-        }
+void handle_selection(const PlayerInput *input) {
+    if (input->select) {
+        NearestQuery query = {&protesters, input->mouse_pos, 50.0f, false, false, false};
+        float closest_dist;
+        int closest_entity = find_nearest(&query, &closest_dist);
         if (closest_entity != -1) {
             if (selected_entity != -1) {
-                Entity *prev_selected = &protesters[selected_entity];
-                prev_selected->is_player_controlled = false;
+                protesters.cold[selected_entity].is_player_controlled = false;
             }
             selected_entity = closest_entity;
             selected_type = PROTESTER;
-            Entity *new_selected = &protesters[selected_entity];
-            new_selected->is_player_controlled = true;
-            new_selected->is_taking_cover = false;
-            new_selected->cover_barrier_id = -1;
-            new_selected->ai_state = MOVING;
+            protesters.cold[selected_entity].is_player_controlled = true;
+            protesters.taking_cover[selected_entity] = false;
+            protesters.cold[selected_entity].cover_slot = -1;
+            UnitTally was = store_tally(&protesters, selected_entity);
+            protesters.ai_state[selected_entity] = MOVING;
+            recount_unit(&protester_counts, was, store_tally(&protesters, selected_entity));
         } else {
             if (selected_entity != -1) {
-                Entity *prev_selected = &protesters[selected_entity];
-                prev_selected->is_player_controlled = false;
+                protesters.cold[selected_entity].is_player_controlled = false;
             }
             selected_entity = -1;
         }
     }
 }
 
-void update_game() {
-    update_morale();
-    update_protester_cover();
-    handle_selection();
-    for (int i = 0; i < MAX_PROTESTERS; i++) {
-        if (protesters[i].active && !protesters[i].is_player_controlled) {
-            update_protester_ai(&protesters[i], i);
+bool queue_push(WorkQueue *queue, Job job) {
+    pthread_mutex_lock(&queue->lock);
+    bool pushed = queue->bottom - queue->top < WORK_QUEUE_SIZE;
+    if (pushed) queue->jobs[queue->bottom++ % WORK_QUEUE_SIZE] = job;
+    pthread_mutex_unlock(&queue->lock);
+    return pushed;
+}
+
+bool queue_pop(WorkQueue *queue, Job *job) {
+    pthread_mutex_lock(&queue->lock);
+    bool popped = queue->bottom != queue->top;
+    if (popped) *job = queue->jobs[--queue->bottom % WORK_QUEUE_SIZE];
+    pthread_mutex_unlock(&queue->lock);
+    return popped;
+}
+
+bool queue_steal(WorkQueue *queue, Job *job) {
+    pthread_mutex_lock(&queue->lock);
+    bool stolen = queue->bottom != queue->top;
+    if (stolen) *job = queue->jobs[queue->top++ % WORK_QUEUE_SIZE];
+    pthread_mutex_unlock(&queue->lock);
+    return stolen;
+}
+
+void reset_graph(TaskGraph *graph) {
+    graph->task_count = 0;
+}
+
+int add_task(TaskGraph *graph, RangeJob job, void *ctx, int count, int chunk) {
+    Task *task = &graph->tasks[graph->task_count];
+    task->job = job;
+    task->ctx = ctx;
+    task->count = count;
+    task->chunk = chunk;
+    task->successor_count = 0;
+    task->dependency_count = 0;
+    return graph->task_count++;
+}
+
+void task_after(TaskGraph *graph, int task, int dependency) {
+    Task *before = &graph->tasks[dependency];
+    before->successors[before->successor_count++] = task;
+    graph->tasks[task].dependency_count++;
+}
+
+void run_job(int thread, Job job);
+
+void complete_task(int thread, Task *task) {
+    TaskGraph *graph = thread_pool.graph;
+    for (int i = 0; i < task->successor_count; i++) {
+        Task *next = &graph->tasks[task->successors[i]];
+        if (atomic_fetch_sub(&next->waiting, 1) == 1) {
+            Job job = {next, 0, next->count};
+            if (next->count == 0) {
+                complete_task(thread, next);
+            } else if (!queue_push(&thread_pool.queues[thread], job)) {
+                run_job(thread, job);
+            }
         }
     }
-    for (int i = 0; i < MAX_POLICE; i++) {
-        if (police[i].active) {
-            update_police_ai(&police[i], i);
+    atomic_fetch_sub(&graph->unfinished, 1);
+}
+
+// Splits off the upper half of the range for thieves until what is left is
+// one chunk, then runs it.
+void run_job(int thread, Job job) {
+    while (job.end - job.begin > job.task->chunk) {
+        int mid = job.begin + (job.end - job.begin) / 2;
+        if (!queue_push(&thread_pool.queues[thread], (Job){job.task, mid, job.end})) break;
+        job.end = mid;
+    }
+    job.task->job(job.task->ctx, job.begin, job.end);
+    int done = job.end - job.begin;
+    if (atomic_fetch_sub(&job.task->remaining, done) == done) complete_task(thread, job.task);
+}
+
+void work_until_done(int thread) {
+    ThreadPool *pool = &thread_pool;
+    int threads = pool->worker_count + 1;
+    Job job;
+    while (atomic_load(&pool->graph->unfinished) > 0) {
+        bool found = queue_pop(&pool->queues[thread], &job);
+        for (int i = 1; !found && i < threads; i++) {
+            found = queue_steal(&pool->queues[(thread + i) % threads], &job);
         }
+        if (found) {
+            run_job(thread, job);
+        } else {
+            sched_yield();
+        }
+    }
+}
+
+void *pool_worker(void *arg) {
+    ThreadPool *pool = &thread_pool;
+    int thread = (int)(intptr_t)arg;
+    unsigned seen = 0;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->generation == seen && !pool->quit) pthread_cond_wait(&pool->wake, &pool->lock);
+        if (pool->quit) break;
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+        work_until_done(thread);
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0) pthread_cond_signal(&pool->done);
     }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+int default_thread_count() {
+#ifdef _SC_NPROCESSORS_ONLN
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n > MAX_THREADS) return MAX_THREADS;
+    return n > 1 ? (int)n : 1;
+#else
+    return 1;
+#endif
+}
+
+// Starts threads - 1 workers; the caller of run_graph is the last one.
+void start_thread_pool(int threads) {
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+    for (int i = 0; i < threads; i++) pthread_mutex_init(&thread_pool.queues[i].lock, NULL);
+    while (thread_pool.worker_count < threads - 1 &&
+           pthread_create(&thread_pool.workers[thread_pool.worker_count], NULL, pool_worker,
+                          (void *)(intptr_t)(thread_pool.worker_count + 1)) == 0) {
+        thread_pool.worker_count++;
+    }
+}
+
+void stop_thread_pool() {
+    pthread_mutex_lock(&thread_pool.lock);
+    thread_pool.quit = true;
+    pthread_cond_broadcast(&thread_pool.wake);
+    pthread_mutex_unlock(&thread_pool.lock);
+    for (int i = 0; i < thread_pool.worker_count; i++) pthread_join(thread_pool.workers[i], NULL);
+    thread_pool.worker_count = 0;
+    thread_pool.quit = false;
+}
+
+// Runs every task of the graph and returns once all have finished. Without
+// workers the tasks simply run in the order they were added.
+void run_graph(TaskGraph *graph) {
+    ThreadPool *pool = &thread_pool;
+    if (pool->worker_count == 0) {
+        for (int i = 0; i < graph->task_count; i++) {
+            Task *task = &graph->tasks[i];
+            if (task->count > 0) task->job(task->ctx, 0, task->count);
+        }
+        return;
+    }
+    atomic_store(&graph->unfinished, graph->task_count);
+    for (int i = 0; i < graph->task_count; i++) {
+        atomic_store(&graph->tasks[i].waiting, graph->tasks[i].dependency_count);
+        atomic_store(&graph->tasks[i].remaining, graph->tasks[i].count);
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->graph = graph;
+    pool->busy = pool->worker_count;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < graph->task_count; i++) {
+        Task *task = &graph->tasks[i];
+        if (task->dependency_count > 0) continue;
+        if (task->count == 0) {
+            complete_task(0, task);
+        } else if (!queue_push(&pool->queues[0], (Job){task, 0, task->count})) {
+            run_job(0, (Job){task, 0, task->count});
+        }
+    }
+    work_until_done(0);
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy > 0) pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+const char *phase_names[PHASE_COUNT] = {
+    "morale", "cover", "selection", "grids", "protester AI", "police AI",
+    "commit", "projectiles", "conditions", "compact",
+    "draw static", "draw units", "draw shots", "draw UI"
+};
+
+// Start of a timed stage, or 0 while profiling is off so the disabled cost
+// is one branch per stage.
+int64_t profile_begin() {
+    if (!profiler.enabled) return 0;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void profile_end(Phase phase, int64_t start) {
+    if (!profiler.enabled) return;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    int64_t now = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    atomic_fetch_add_explicit(&profiler.pending[phase], now - start, memory_order_relaxed);
+}
+
+void set_profiling(bool enabled) {
+    for (int p = 0; p < PHASE_COUNT; p++) atomic_store(&profiler.pending[p], 0);
+    profiler.frames = 0;
+    profiler.next = 0;
+    profiler.enabled = enabled;
+}
+
+// Closes a frame (or a headless tick) while no stage is running.
+void profile_frame() {
+    if (!profiler.enabled) return;
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        profiler.history[p][profiler.next] = atomic_exchange(&profiler.pending[p], 0) * 1e-6f;
+    }
+    profiler.next = (profiler.next + 1) % PROFILE_HISTORY;
+    if (profiler.frames < PROFILE_HISTORY) profiler.frames++;
+}
+
+int compare_floats(const void *a, const void *b) {
+    float x = *(const float *)a, y = *(const float *)b;
+    return (x > y) - (x < y);
+}
+
+// Average and 99th percentile of n timings, sorting them in place.
+void timing_stats(float *samples, int n, float *average, float *p99) {
+    if (n == 0) {
+        *average = *p99 = 0.0f;
+        return;
+    }
+    double sum = 0.0;
+    for (int k = 0; k < n; k++) sum += samples[k];
+    qsort(samples, n, sizeof(float), compare_floats);
+    *average = (float)(sum / n);
+    *p99 = samples[(int)ceilf(0.99f * n) - 1];
+}
+
+// Average and 99th percentile of a phase over the recorded frames, in ms.
+void profile_stats(Phase phase, float *average, float *p99) {
+    float sorted[PROFILE_HISTORY];
+    int n = profiler.frames;
+    for (int k = 0; k < n; k++) sorted[k] = profiler.history[phase][k];
+    timing_stats(sorted, n, average, p99);
+}
+
+// A cell is far when even its nearest corner is out of reach of every cell
+// holding an enemy. Separable distance transform over the grid: first the
+// column gap to the nearest enemy cell within each row, then, per cell, the
+// closest of those rows. Costs O(cells * rows) whatever the unit count.
+void build_lod_map(LodMap *map, const SpatialGrid *enemies, float reach) {
+    if (!config.ai_lod) return;
+    int row_gap[GRID_ROWS][GRID_COLS];
+    for (int cy = 0; cy < GRID_ROWS; cy++) {
+        int *gap = row_gap[cy];
+        int last = -GRID_COLS * 2;
+        for (int cx = 0; cx < GRID_COLS; cx++) {
+            int c = cy * GRID_COLS + cx;
+            if (enemies->cell_start[c + 1] > enemies->cell_start[c]) last = cx;
+            gap[cx] = cx - last;
+        }
+        last = GRID_COLS * 3;
+        for (int cx = GRID_COLS - 1; cx >= 0; cx--) {
+            int c = cy * GRID_COLS + cx;
+            if (enemies->cell_start[c + 1] > enemies->cell_start[c]) last = cx;
+            if (last - cx < gap[cx]) gap[cx] = last - cx;
+        }
+        for (int cx = 0; cx < GRID_COLS; cx++) gap[cx] = gap[cx] > 0 ? gap[cx] - 1 : 0;
+    }
+    float reach_cells_sq = (reach / GRID_CELL_SIZE) * (reach / GRID_CELL_SIZE);
+    for (int cy = 0; cy < GRID_ROWS; cy++) {
+        for (int cx = 0; cx < GRID_COLS; cx++) {
+            bool far = true;
+            for (int ey = 0; ey < GRID_ROWS && far; ey++) {
+                int gap_y = abs(ey - cy) - 1;
+                if (gap_y < 0) gap_y = 0;
+                float gap_x = (float)row_gap[ey][cx];
+                if (gap_x * gap_x + (float)(gap_y * gap_y) < reach_cells_sq) far = false;
+            }
+            map->far[cy * GRID_COLS + cx] = far;
+        }
+    }
+}
+
+// True when unit i can skip its AI this tick: it is out of reach of every
+// enemy, not fighting, fleeing or heading for cover, and this is not its
+// turn among the LOD_INTERVAL staggered ticks.
+bool ai_lod_skip(const EntityStore *store, int i, const LodMap *map) {
+    if (!config.ai_lod || (game.tick + store->cold[i].lod_phase) % LOD_INTERVAL == 0) return false;
+    AIState state = store->ai_state[i];
+    if (state == ATTACKING || state == RETREATING || state == DYING || store->taking_cover[i]) return false;
+    if (store->cold[i].type == POLICE && store->cold[i].police_type == HELICOPTER) return false;
+    return map->far[grid_cell(store->pos_x[i], store->pos_y[i])];
+}
+
+// Carries a skipped unit along its last velocity.
+void coast_entity(Entity *entity, float dt) {
+    if (entity->cooldown > 0) entity->cooldown -= dt;
+    if (entity->animation_timer > 0) entity->animation_timer -= dt;
+    Vector2 new_pos = Vector2Add(entity->position, Vector2Scale(entity->velocity, dt));
+    if (!blocked_by_barrier(new_pos)) entity->position = new_pos;
+    if (entity->position.x < COVER_WIDTH) entity->position.x = COVER_WIDTH;
+    if (entity->position.x > SCREEN_WIDTH - COVER_WIDTH) entity->position.x = SCREEN_WIDTH - COVER_WIDTH;
+    if (entity->position.y < COVER_HEIGHT / 2) entity->position.y = COVER_HEIGHT / 2;
+    if (entity->position.y > SCREEN_HEIGHT - COVER_HEIGHT / 2) entity->position.y = SCREEN_HEIGHT - COVER_HEIGHT / 2;
+}
+
+// One AI update per entity of the combined range, protesters first and then
+// police. Every update reads the current stores, which nobody writes during
+// the phase, and writes only its own slot of the next stores and its own
+// effects, so the outcome does not depend on how the range is split.
+void update_ai_range(void *ctx, int begin, int end) {
+    float dt = ((const TickContext *)ctx)->dt;
+    Entity entity;
+    int split = end < protesters.count ? end : protesters.count;
+    int64_t start = profile_begin();
+    for (int i = begin; i < split; i++) {
+        AIEffects *effects = &protester_effects[i];
+        effects->shot_count = 0;
+        effects->melee_target = -1;
+        load_entity(&protesters, i, &entity);
+        entity.effects = effects;
+        if (entity.active && !entity.is_player_controlled) {
+            if (ai_lod_skip(&protesters, i, &protester_lod)) {
+                coast_entity(&entity, dt);
+            } else {
+                update_protester_ai(&entity, i, dt);
+            }
+        }
+        recount_unit(&protester_counts, store_tally(&protesters, i), entity_tally(&entity));
+        store_entity(&protesters_next, i, &entity);
+    }
+    if (begin < split) profile_end(PHASE_PROTESTER_AI, start);
+    start = profile_begin();
+    for (int k = begin > split ? begin : split; k < end; k++) {
+        int i = k - protesters.count;
+        AIEffects *effects = &police_effects[i];
+        effects->shot_count = 0;
+        effects->melee_target = -1;
+        load_entity(&police, i, &entity);
+        entity.effects = effects;
+        if (entity.active) {
+            if (ai_lod_skip(&police, i, &police_lod)) {
+                coast_entity(&entity, dt);
+            } else {
+                update_police_ai(&entity, i, dt);
+            }
+        }
+        recount_unit(&police_counts, store_tally(&police, i), entity_tally(&entity));
+        store_entity(&police_next, i, &entity);
+    }
+    if (split < end) profile_end(PHASE_POLICE_AI, start);
+}
+
+void apply_team_effects(EntityStore *store, const AIEffects *effects) {
+    for (int i = 0; i < store->count; i++) {
+        for (int k = 0; k < effects[i].shot_count; k++) {
+            const Shot *shot = &effects[i].shots[k];
+            if (launch_projectile(shot->pos, shot->dir, shot->type)) {
+                store->cold[i].animation_timer = ANIMATION_DURATION;
+            }
+        }
+        if (effects[i].melee_target != -1) apply_melee_hit(effects[i].melee_target);
+    }
+}
+
+void swap_stores(EntityStore *a, EntityStore *b) {
+    EntityStore tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+void morale_job(void *ctx, int begin, int end) {
+    int64_t start = profile_begin();
+    update_morale(((const TickContext *)ctx)->dt);
+    profile_end(PHASE_MORALE, start);
+}
+
+void cover_job(void *ctx, int begin, int end) {
+    int64_t start = profile_begin();
+    update_protester_cover(((const TickContext *)ctx)->dt);
+    profile_end(PHASE_COVER, start);
+}
+
+void selection_job(void *ctx, int begin, int end) {
+    int64_t start = profile_begin();
+    handle_selection(((const TickContext *)ctx)->input);
+    profile_end(PHASE_SELECTION, start);
+}
+
+void protester_grid_job(void *ctx, int begin, int end) {
+    int64_t start = profile_begin();
+    build_grid(&protester_grid, &protesters);
+    profile_end(PHASE_GRIDS, start);
+}
+
+void police_grid_job(void *ctx, int begin, int end) {
+    int64_t start = profile_begin();
+    build_grid(&police_grid, &police);
+    profile_end(PHASE_GRIDS, start);
+}
+
+void protester_density_job(void *ctx, int begin, int end) {
+    int64_t start = profile_begin();
+    build_density_map(&protester_density, &protesters, false);
+    profile_end(PHASE_GRIDS, start);
+}
+
+void police_density_job(void *ctx, int begin, int end) {
+    int64_t start = profile_begin();
+    build_density_map(&police_density, &police, true);
+    profile_end(PHASE_GRIDS, start);
+}
+
+void protester_lod_job(void *ctx, int begin, int end) {
+    int64_t start = profile_begin();
+    build_lod_map(&protester_lod, &police_grid, STONE_RANGE);
+    profile_end(PHASE_GRIDS, start);
+}
+
+void police_lod_job(void *ctx, int begin, int end) {
+    int64_t start = profile_begin();
+    build_lod_map(&police_lod, &protester_grid, BULLET_RANGE);
+    profile_end(PHASE_GRIDS, start);
+}
+
+void integrate_job(void *ctx, int begin, int end) {
+    int64_t start = profile_begin();
+    float dt = ((const TickContext *)ctx)->dt;
+    for (int k = begin; k < end; k++) integrate_projectile(projectile_pool.live[k], dt);
+    profile_end(PHASE_PROJECTILES, start);
+}
+
+// Swaps in the AI results, applies their queued effects, moves the player's
+// unit and integrates whatever was fired this tick.
+void commit_job(void *ctx, int begin, int end) {
+    int64_t start = profile_begin();
+    const TickContext *tick = ctx;
+    swap_stores(&protesters, &protesters_next);
+    swap_stores(&police, &police_next);
+    apply_team_effects(&protesters, protester_effects);
+    apply_team_effects(&police, police_effects);
     if (selected_entity != -1) {
-        Entity *selected = &protesters[selected_entity];
-        if (selected->active) {
-            update_player_controlled(selected);
+        if (protesters.active[selected_entity]) {
+            Entity entity;
+            load_entity(&protesters, selected_entity, &entity);
+            update_player_controlled(&entity, tick->dt, tick->input);
+            recount_unit(&protester_counts, store_tally(&protesters, selected_entity), entity_tally(&entity));
+            store_entity(&protesters, selected_entity, &entity);
         } else {
             selected_entity = -1;
         }
     }
-    update_projectiles();
-    check_game_conditions();
+    profile_end(PHASE_COMMIT, start);
+    start = profile_begin();
+    for (int k = tick->projectiles_in_flight; k < projectile_pool.live_count; k++) {
+        integrate_projectile(projectile_pool.live[k], tick->dt);
+    }
+    profile_end(PHASE_PROJECTILES, start);
+}
+
+void resolve_job(void *ctx, int begin, int end) {
+    int64_t start = profile_begin();
+    resolve_projectiles(((const TickContext *)ctx)->projectiles_in_flight);
+    profile_end(PHASE_PROJECTILES, start);
+}
+
+void conditions_job(void *ctx, int begin, int end) {
+    int64_t start = profile_begin();
+    check_game_conditions(((const TickContext *)ctx)->dt);
+    profile_end(PHASE_CONDITIONS, start);
+}
+
+// Compacts both teams and fixes up every index that survives the tick.
+void compact_job(void *ctx, int begin, int end) {
+    int64_t start = profile_begin();
+    int protester_slots = protesters.count, police_slots = police.count;
+    bool protesters_moved = compact_store(&protesters, protester_remap);
+    bool police_moved = compact_store(&police, police_remap);
+    if (protesters_moved) {
+        if (selected_entity != -1) selected_entity = protester_remap[selected_entity];
+        for (int i = 0; i < police.count; i++) {
+            int *target = &police.cold[i].target_id;
+            if (*target >= 0 && *target < protester_slots) *target = protester_remap[*target];
+        }
+    }
+    if (police_moved) {
+        for (int i = 0; i < protesters.count; i++) {
+            int *target = &protesters.cold[i].target_id;
+            if (*target >= 0 && *target < police_slots) *target = police_remap[*target];
+        }
+    }
+    profile_end(PHASE_COMPACT, start);
+}
+
+// One tick as a task graph. Edges follow what each phase reads and writes:
+// the grids, density maps and projectile integration do not touch what
+// morale, cover and selection change, so they run next to them, and
+// projectiles already in flight move while the AI runs.
+void update_game(float dt, const PlayerInput *input) {
+    TickContext tick = {dt, input, projectile_pool.live_count};
+    protesters_next.count = protesters.count;
+    police_next.count = police.count;
+    TaskGraph *graph = &tick_graph;
+    reset_graph(graph);
+    int morale = add_task(graph, morale_job, &tick, 1, 1);
+    int cover = add_task(graph, cover_job, &tick, 1, 1);
+    int selection = add_task(graph, selection_job, &tick, 1, 1);
+    task_after(graph, selection, cover);
+    int protester_grid_task = add_task(graph, protester_grid_job, &tick, 1, 1);
+    int police_grid_task = add_task(graph, police_grid_job, &tick, 1, 1);
+    int protester_density_task = add_task(graph, protester_density_job, &tick, 1, 1);
+    task_after(graph, protester_density_task, selection);
+    int police_density_task = add_task(graph, police_density_job, &tick, 1, 1);
+    int protester_lod_task = add_task(graph, protester_lod_job, &tick, 1, 1);
+    task_after(graph, protester_lod_task, police_grid_task);
+    int police_lod_task = add_task(graph, police_lod_job, &tick, 1, 1);
+    task_after(graph, police_lod_task, protester_grid_task);
+    int integrate = add_task(graph, integrate_job, &tick, tick.projectiles_in_flight, PROJECTILE_CHUNK_SIZE);
+    int ai = add_task(graph, update_ai_range, &tick, protesters.count + police.count, AI_CHUNK_SIZE);
+    task_after(graph, ai, morale);
+    task_after(graph, ai, selection);
+    task_after(graph, ai, protester_grid_task);
+    task_after(graph, ai, police_grid_task);
+    task_after(graph, ai, protester_density_task);
+    task_after(graph, ai, police_density_task);
+    task_after(graph, ai, protester_lod_task);
+    task_after(graph, ai, police_lod_task);
+    int commit = add_task(graph, commit_job, &tick, 1, 1);
+    task_after(graph, commit, ai);
+    task_after(graph, commit, integrate);
+    // Hit detection needs the post-movement positions.
+    int protester_regrid = add_task(graph, protester_grid_job, &tick, 1, 1);
+    task_after(graph, protester_regrid, commit);
+    int police_regrid = add_task(graph, police_grid_job, &tick, 1, 1);
+    task_after(graph, police_regrid, commit);
+    int resolve = add_task(graph, resolve_job, &tick, 1, 1);
+    task_after(graph, resolve, protester_regrid);
+    task_after(graph, resolve, police_regrid);
+    int conditions = add_task(graph, conditions_job, &tick, 1, 1);
+    task_after(graph, conditions, resolve);
+    int compact = add_task(graph, compact_job, &tick, 1, 1);
+    task_after(graph, compact, conditions);
+    run_graph(graph);
+    game.tick++;
 }
 
-void reset_game() {
-    for (int i = 0; i < MAX_PROTESTERS; i++) protesters[i].active = false;
-    for (int i = 0; i < MAX_POLICE; i++) police[i].active = false;
-    for (int i = 0; i < MAX_PROJECTILES; i++) projectiles[i].active = false;
-    for (int i = 0; i < MAX_BARRIERS; i++) barriers[i].active = false;
+void reset_game(uint64_t seed) {
     selected_entity = -1;
-    init_game();
+    init_game(seed);
     game.state = PLAYING;
 }
 
+void hash_bytes(uint64_t *hash, const void *data, size_t size) {
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        *hash = (*hash ^ bytes[i]) * 0x100000001B3ULL;
+    }
+}
+
+void hash_store(uint64_t *hash, const EntityStore *store) {
+    hash_bytes(hash, store->pos_x, store->count * sizeof(float));
+    hash_bytes(hash, store->pos_y, store->count * sizeof(float));
+    hash_bytes(hash, store->vel_x, store->count * sizeof(float));
+    hash_bytes(hash, store->vel_y, store->count * sizeof(float));
+    hash_bytes(hash, store->active, store->count * sizeof(bool));
+    hash_bytes(hash, store->ai_state, store->count * sizeof(AIState));
+    hash_bytes(hash, store->taking_cover, store->count * sizeof(bool));
+    for (int i = 0; i < store->count; i++) {
+        hash_bytes(hash, &store->cold[i].bullet_health, sizeof(store->cold[i].bullet_health));
+        hash_bytes(hash, &store->cold[i].melee_health, sizeof(store->cold[i].melee_health));
+        hash_bytes(hash, &store->cold[i].cooldown, sizeof(store->cold[i].cooldown));
+    }
+}
+
+// FNV-1a over the simulated state, field by field so struct padding never
+// leaks in. Two runs with the same seed and inputs must agree on it.
+uint64_t state_checksum() {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    hash_store(&hash, &protesters);
+    hash_store(&hash, &police);
+    for (int k = 0; k < projectile_pool.live_count; k++) {
+        const Projectile *projectile = &projectiles[projectile_pool.live[k]];
+        hash_bytes(&hash, &projectile->position, sizeof(projectile->position));
+        hash_bytes(&hash, &projectile->velocity, sizeof(projectile->velocity));
+    }
+    hash_bytes(&hash, &game.state, sizeof(game.state));
+    hash_bytes(&hash, &game.territory_hold_timer, sizeof(game.territory_hold_timer));
+    hash_bytes(&hash, &game.rng, sizeof(game.rng));
+    return hash;
+}
+
+// Parses the match options both builds share. Returns how many arguments
+// were used at argv[i], or 0 if argv[i] is not one of them.
+int parse_match_option(int argc, char **argv, int i) {
+    if (strcmp(argv[i], "--point-hits") == 0) {
+        config.swept_projectiles = false;
+        return 1;
+    }
+    if (strcmp(argv[i], "--ai-lod") == 0) {
+        config.ai_lod = true;
+        return 1;
+    }
+    if (i + 1 >= argc) return 0;
+    if (strcmp(argv[i], "--protesters") == 0) {
+        config.protester_count = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "--police") == 0) {
+        config.police_count = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "--barriers") == 0) {
+        config.barrier_count = atoi(argv[i + 1]);
+    } else {
+        return 0;
+    }
+    if (config.protester_count < 0) config.protester_count = 0;
+    if (config.police_count < 1) config.police_count = 1;
+    if (config.barrier_count < 0) config.barrier_count = 0;
+    return 2;
+}
+
+// Wall-clock seconds from a monotonic source. clock() would add up the CPU
+// time of every pool thread.
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void write_varint(FILE *file, uint64_t value) {
+    while (value >= 0x80) {
+        fputc((int)(value & 0x7F) | 0x80, file);
+        value >>= 7;
+    }
+    fputc((int)value, file);
+}
+
+bool read_varint(FILE *file, uint64_t *value) {
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int byte = fgetc(file);
+        if (byte == EOF) return false;
+        *value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+uint64_t zigzag(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+int64_t unzigzag(uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+int input_flags(const PlayerInput *input) {
+    return input->move_up | input->move_down << 1 | input->move_left << 2 | input->move_right << 3 |
+           (input->fire ? REPLAY_FIRE : 0) | (input->select ? REPLAY_SELECT : 0);
+}
+
+// Starts recording a match that init_game(seed) set up with the current
+// config. Returns false if the file cannot be created.
+bool start_recording(Replay *replay, const char *path, uint64_t seed) {
+    *replay = (Replay){0};
+    replay->file = fopen(path, "wb");
+    if (!replay->file) return false;
+    fwrite(REPLAY_MAGIC, 1, 4, replay->file);
+    fputc(REPLAY_VERSION, replay->file);
+    write_varint(replay->file, seed);
+    fputc(config.swept_projectiles | config.ai_lod << 1, replay->file);
+    write_varint(replay->file, config.protester_count);
+    write_varint(replay->file, config.police_count);
+    write_varint(replay->file, config.barrier_count);
+    write_varint(replay->file, config.projectile_capacity);
+    return true;
+}
+
+// Call with the input of every tick, before the tick runs.
+void record_input(Replay *replay, const PlayerInput *input) {
+    int flags = input_flags(input);
+    if (flags != replay->keys) {
+        write_varint(replay->file, replay->tick - replay->record_tick);
+        fputc(flags, replay->file);
+        if (flags & (REPLAY_FIRE | REPLAY_SELECT)) {
+            int x = (int)input->mouse_pos.x, y = (int)input->mouse_pos.y;
+            write_varint(replay->file, zigzag(x - replay->mouse_x));
+            write_varint(replay->file, zigzag(y - replay->mouse_y));
+            replay->mouse_x = x;
+            replay->mouse_y = y;
+        }
+        replay->record_tick = replay->tick;
+        replay->keys = flags & 0x0F;
+    }
+    replay->tick++;
+}
+
+void stop_recording(Replay *replay) {
+    if (!replay->file) return;
+    write_varint(replay->file, replay->tick - replay->record_tick);
+    fputc(REPLAY_END, replay->file);
+    write_varint(replay->file, replay->tick);
+    write_varint(replay->file, state_checksum());
+    fclose(replay->file);
+    replay->file = NULL;
+}
+
+// Reads the next record header into replay->record_tick and flags.
+bool read_replay_record(Replay *replay) {
+    uint64_t delta;
+    int flags;
+    if (!read_varint(replay->file, &delta) || (flags = fgetc(replay->file)) == EOF) return false;
+    replay->record_tick += (long)delta;
+    replay->flags = flags;
+    return true;
+}
+
+// Opens a recording and restores its seed and match options into config.
+// Returns false for a missing or malformed file.
+bool start_playback(Replay *replay, const char *path, uint64_t *seed) {
+    *replay = (Replay){0};
+    replay->file = fopen(path, "rb");
+    if (!replay->file) return false;
+    char magic[4];
+    uint64_t counts[4];
+    bool ok = fread(magic, 1, 4, replay->file) == 4 && memcmp(magic, REPLAY_MAGIC, 4) == 0 &&
+              fgetc(replay->file) == REPLAY_VERSION && read_varint(replay->file, seed);
+    int options = ok ? fgetc(replay->file) : EOF;
+    ok = ok && options != EOF;
+    for (int k = 0; k < 4 && ok; k++) ok = read_varint(replay->file, &counts[k]);
+    ok = ok && read_replay_record(replay);
+    if (!ok) {
+        fclose(replay->file);
+        replay->file = NULL;
+        return false;
+    }
+    config.swept_projectiles = options & 1;
+    config.ai_lod = (options & 2) != 0;
+    config.protester_count = (int)counts[0];
+    config.police_count = (int)counts[1];
+    config.barrier_count = (int)counts[2];
+    config.projectile_capacity = (int)counts[3];
+    return true;
+}
+
+// True once every recorded tick has been played. replay->end_tick and
+// checksum then describe how the recording ended.
+bool replay_ended(Replay *replay) {
+    if (!replay->file) return true;
+    if (replay->tick != replay->record_tick || !(replay->flags & REPLAY_END)) return false;
+    uint64_t end_tick, checksum;
+    if (read_varint(replay->file, &end_tick) && read_varint(replay->file, &checksum)) {
+        replay->end_tick = (long)end_tick;
+        replay->checksum = checksum;
+    }
+    fclose(replay->file);
+    replay->file = NULL;
+    return true;
+}
+
+// Fills in the input for the next tick, which must not be past the end.
+void play_input(Replay *replay, PlayerInput *input) {
+    int flags = replay->keys;
+    if (replay->tick == replay->record_tick) {
+        flags = replay->flags;
+        if (flags & (REPLAY_FIRE | REPLAY_SELECT)) {
+            uint64_t dx, dy;
+            if (read_varint(replay->file, &dx) && read_varint(replay->file, &dy)) {
+                replay->mouse_x += (int)unzigzag(dx);
+                replay->mouse_y += (int)unzigzag(dy);
+            }
+        }
+        replay->keys = flags & 0x0F;
+        if (!read_replay_record(replay)) {
+            // Truncated: stop after this tick.
+            replay->record_tick = replay->tick + 1;
+            replay->flags = REPLAY_END;
+        }
+    }
+    input->move_up = flags & 1;
+    input->move_down = flags & 2;
+    input->move_left = flags & 4;
+    input->move_right = flags & 8;
+    input->fire = flags & REPLAY_FIRE;
+    input->select = flags & REPLAY_SELECT;
+    input->mouse_pos = (Vector2){(float)replay->mouse_x, (float)replay->mouse_y};
+    replay->tick++;
+}
+
+void report_replay(const Replay *replay) {
+    if (replay->end_tick == 0) {
+        printf("replay: recording is cut off after tick %ld\n", replay->tick);
+    } else if (replay->end_tick != replay->tick) {
+        printf("replay: stopped at tick %ld of %ld\n", replay->tick, replay->end_tick);
+    } else if (replay->checksum == state_checksum()) {
+        printf("replay: %ld ticks, checksum matches\n", replay->tick);
+    } else {
+        printf("replay: %ld ticks, checksum %016llx differs from recorded %016llx\n", replay->tick,
+               (unsigned long long)state_checksum(), (unsigned long long)replay->checksum);
+    }
+}
+
+void snapshot_struct_sizes(uint32_t *sizes) {
+    sizes[0] = sizeof(SnapshotHeader);
+    sizes[1] = sizeof(EntityCold);
+    sizes[2] = sizeof(Projectile);
+    sizes[3] = sizeof(Barrier);
+    sizes[4] = sizeof(AIState);
+}
+
+// Where each snapshot array lives, in file order.
+void snapshot_arrays(void **arrays) {
+    int n = 0;
+    EntityStore *teams[2] = {&protesters, &police};
+    for (int t = 0; t < 2; t++) {
+        EntityStore *store = teams[t];
+        arrays[n++] = store->pos_x;
+        arrays[n++] = store->pos_y;
+        arrays[n++] = store->vel_x;
+        arrays[n++] = store->vel_y;
+        arrays[n++] = store->active;
+        arrays[n++] = store->ai_state;
+        arrays[n++] = store->taking_cover;
+        arrays[n++] = store->cold;
+    }
+    arrays[n++] = projectiles;
+    arrays[n++] = projectile_pool.free_slots;
+    arrays[n++] = projectile_pool.live;
+    arrays[n++] = projectile_pool.live_index;
+    arrays[n++] = barriers;
+}
+
+// Byte size of each snapshot array for the counts in a header.
+void snapshot_sizes(const SnapshotHeader *header, uint64_t *sizes) {
+    int n = 0;
+    int team_counts[2] = {header->protester_count, header->police_count};
+    for (int t = 0; t < 2; t++) {
+        uint64_t count = team_counts[t];
+        sizes[n++] = count * sizeof(float);
+        sizes[n++] = count * sizeof(float);
+        sizes[n++] = count * sizeof(float);
+        sizes[n++] = count * sizeof(float);
+        sizes[n++] = count * sizeof(bool);
+        sizes[n++] = count * sizeof(AIState);
+        sizes[n++] = count * sizeof(bool);
+        sizes[n++] = count * sizeof(EntityCold);
+    }
+    uint64_t slots = header->projectile_capacity;
+    sizes[n++] = slots * sizeof(Projectile);
+    sizes[n++] = slots * sizeof(int);
+    sizes[n++] = slots * sizeof(int);
+    sizes[n++] = slots * sizeof(int);
+    sizes[n++] = (uint64_t)header->barrier_count * sizeof(Barrier);
+}
+
+// Writes the whole match state. Call between ticks.
+bool save_snapshot(const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (!file) return false;
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, 4);
+    header.version = SNAPSHOT_VERSION;
+    snapshot_struct_sizes(header.struct_sizes);
+    header.config = config;
+    header.game = game;
+    header.selected_entity = selected_entity;
+    header.selected_type = selected_type;
+    header.protester_count = protesters.count;
+    header.police_count = police.count;
+    header.projectile_capacity = projectile_pool.capacity;
+    header.projectile_free_count = projectile_pool.free_count;
+    header.projectile_live_count = projectile_pool.live_count;
+    header.barrier_count = barrier_count;
+    void *arrays[SNAPSHOT_ARRAYS];
+    snapshot_arrays(arrays);
+    snapshot_sizes(&header, header.sizes);
+    uint64_t offset = sizeof(header);
+    for (int k = 0; k < SNAPSHOT_ARRAYS; k++) {
+        offset = (offset + SNAPSHOT_ALIGN - 1) / SNAPSHOT_ALIGN * SNAPSHOT_ALIGN;
+        header.offsets[k] = offset;
+        offset += header.sizes[k];
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    uint64_t written = sizeof(header);
+    for (int k = 0; k < SNAPSHOT_ARRAYS && ok; k++) {
+        while (written < header.offsets[k] && ok) {
+            ok = fputc(0, file) != EOF;
+            written++;
+        }
+        if (header.sizes[k] > 0) ok = ok && fwrite(arrays[k], header.sizes[k], 1, file) == 1;
+        written += header.sizes[k];
+    }
+    return fclose(file) == 0 && ok;
+}
+
+bool snapshot_team_valid(const unsigned char *map, const SnapshotHeader *header, int first_array,
+                         EntityType type, int count, int enemy_count, int cover_slot_count) {
+    const bool *active = (const bool *)(map + header->offsets[first_array + 4]);
+    const AIState *ai_state = (const AIState *)(map + header->offsets[first_array + 5]);
+    const bool *taking_cover = (const bool *)(map + header->offsets[first_array + 6]);
+    const EntityCold *cold = (const EntityCold *)(map + header->offsets[first_array + 7]);
+    for (int i = 0; i < count; i++) {
+        unsigned char active_byte, cover_byte;
+        memcpy(&active_byte, &active[i], 1);
+        memcpy(&cover_byte, &taking_cover[i], 1);
+        if (active_byte > 1 || cover_byte > 1) return false;
+        if ((unsigned)ai_state[i] >= AI_STATE_COUNT) return false;
+        const EntityCold *unit = &cold[i];
+        if (unit->type != type || (unsigned)unit->police_type >= POLICE_TYPE_COUNT) return false;
+        if (unit->target_id < -1 || unit->target_id >= enemy_count) return false;
+        if (unit->cover_slot < -1 || unit->cover_slot >= cover_slot_count) return false;
+        if (unit->lod_phase < 0 || unit->lod_phase >= LOD_INTERVAL) return false;
+    }
+    return true;
+}
+
+// Checks every index and enum stored in a snapshot whose sizes already
+// match its header, so a corrupted file cannot index out of bounds.
+bool snapshot_contents_valid(const unsigned char *map, const SnapshotHeader *header) {
+    const Barrier *saved_barriers = (const Barrier *)(map + header->offsets[20]);
+    int cover_slot_count = 0;
+    for (int i = 0; i < header->barrier_count; i++) {
+        unsigned char active_byte;
+        memcpy(&active_byte, &saved_barriers[i].active, 1);
+        if (active_byte > 1 || (unsigned)saved_barriers[i].type > CONCRETE) return false;
+        if (active_byte) cover_slot_count += COVER_SLOTS_PER_BARRIER;
+    }
+    if ((unsigned)header->game.state > POLICE_WIN || header->game.cover_cycle_phase < 0 ||
+        header->game.cover_cycle_phase > 3 || (header->selected_type != PROTESTER && header->selected_type != POLICE)) {
+        return false;
+    }
+    if (!snapshot_team_valid(map, header, 0, PROTESTER, header->protester_count, header->police_count, cover_slot_count) ||
+        !snapshot_team_valid(map, header, 8, POLICE, header->police_count, header->protester_count, 0)) {
+        return false;
+    }
+    // Free and live slots must together hold every slot exactly once, the
+    // free ones as a min-heap and the live ones matching live_index.
+    int capacity = header->projectile_capacity;
+    const Projectile *saved_projectiles = (const Projectile *)(map + header->offsets[16]);
+    const int *free_slots = (const int *)(map + header->offsets[17]);
+    const int *live = (const int *)(map + header->offsets[18]);
+    const int *live_index = (const int *)(map + header->offsets[19]);
+    bool *seen = calloc(capacity, sizeof(bool));
+    if (!seen) return false;
+    bool ok = true;
+    for (int k = 0; k < header->projectile_free_count && ok; k++) {
+        int slot = free_slots[k];
+        ok = slot >= 0 && slot < capacity && !seen[slot] && (k == 0 || free_slots[(k - 1) / 2] < slot);
+        if (ok) seen[slot] = true;
+    }
+    for (int k = 0; k < header->projectile_live_count && ok; k++) {
+        int slot = live[k];
+        ok = slot >= 0 && slot < capacity && !seen[slot] && live_index[slot] == k &&
+             (unsigned)saved_projectiles[slot].type <= POLICE;
+        if (ok) seen[slot] = true;
+    }
+    free(seen);
+    return ok;
+}
+
+// Replaces the match with a saved one, in place of init_game. Returns false,
+// leaving the current match alone, if the file is missing or does not match
+// this build.
+bool load_snapshot(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat info;
+    const unsigned char *map = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && (size_t)info.st_size >= sizeof(SnapshotHeader)) {
+        map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) return false;
+    SnapshotHeader header;
+    memcpy(&header, map, sizeof(header));
+    uint32_t struct_sizes[5];
+    snapshot_struct_sizes(struct_sizes);
+    bool ok = memcmp(header.magic, SNAPSHOT_MAGIC, 4) == 0 && header.version == SNAPSHOT_VERSION &&
+              memcmp(header.struct_sizes, struct_sizes, sizeof(struct_sizes)) == 0 &&
+              header.protester_count >= 0 && header.police_count >= 0 && header.barrier_count >= 0 &&
+              header.selected_entity >= -1 && header.selected_entity < header.protester_count &&
+              header.projectile_capacity >= MIN_STORE_CAPACITY &&
+              header.projectile_free_count + header.projectile_live_count == header.projectile_capacity;
+    uint64_t sizes[SNAPSHOT_ARRAYS];
+    snapshot_sizes(&header, sizes);
+    for (int k = 0; k < SNAPSHOT_ARRAYS && ok; k++) {
+        ok = header.sizes[k] == sizes[k] && header.offsets[k] <= (uint64_t)info.st_size &&
+             sizes[k] <= (uint64_t)info.st_size - header.offsets[k];
+    }
+    ok = ok && snapshot_contents_valid(map, &header);
+    if (ok) {
+        config = header.config;
+        game = header.game;
+        select_scan_kernels();
+        protesters.count = police.count = 0;
+        reserve_team(PROTESTER, header.protester_count);
+        reserve_team(POLICE, header.police_count);
+        protesters.count = header.protester_count;
+        police.count = header.police_count;
+        reserve_projectiles(header.projectile_capacity);
+        projectile_pool.capacity = header.projectile_capacity;
+        projectile_pool.free_count = header.projectile_free_count;
+        projectile_pool.live_count = header.projectile_live_count;
+        barrier_count = 0;
+        while (barrier_count < header.barrier_count) add_barrier();
+        void *arrays[SNAPSHOT_ARRAYS];
+        snapshot_arrays(arrays);
+        for (int k = 0; k < SNAPSHOT_ARRAYS; k++) {
+            if (sizes[k] > 0) memcpy(arrays[k], map + header.offsets[k], sizes[k]);
+        }
+        selected_entity = header.selected_entity;
+        selected_type = header.selected_type;
+        barriers_changed();
+        reset_team_counts(&protester_counts);
+        reset_team_counts(&police_counts);
+        for (int i = 0; i < protesters.count; i++) count_unit(&protester_counts, store_tally(&protesters, i), 1);
+        for (int i = 0; i < police.count; i++) count_unit(&police_counts, store_tally(&police, i), 1);
+    }
+    munmap((void *)map, info.st_size);
+    return ok;
+}
+
+void write_telemetry_row(FILE *file, const TelemetrySample *sample) {
+    fprintf(file, "%ld", sample->tick);
+    for (int t = 0; t < 2; t++) fprintf(file, ",%d", sample->active[t]);
+    for (int t = 0; t < 2; t++) {
+        for (int k = 0; k < AI_STATE_COUNT; k++) fprintf(file, ",%d", sample->states[t][k]);
+    }
+    fprintf(file, ",%.4f,%.4f,%.3f,%d,%.4f\n", sample->morale[PROTESTER], sample->morale[POLICE],
+            sample->territory_hold_timer, sample->projectiles, sample->tick_ms);
+}
+
+// Prints whatever the game has published, then naps for a millisecond when
+// the ring is empty. Exits once stop is set and the ring is drained.
+void *telemetry_writer(void *arg) {
+    Telemetry *sink = arg;
+    for (;;) {
+        bool stopping = atomic_load_explicit(&sink->stop, memory_order_acquire);
+        unsigned long tail = atomic_load_explicit(&sink->tail, memory_order_relaxed);
+        unsigned long head = atomic_load_explicit(&sink->head, memory_order_acquire);
+        if (tail == head) {
+            if (stopping) break;
+            struct timespec nap = {0, 1000000};
+            nanosleep(&nap, NULL);
+            continue;
+        }
+        for (; tail != head; tail++) write_telemetry_row(sink->file, &sink->ring[tail % TELEMETRY_RING_SIZE]);
+        atomic_store_explicit(&sink->tail, tail, memory_order_release);
+    }
+    return NULL;
+}
+
+// Opens the CSV and starts its writer. Returns false if the file cannot be
+// created.
+bool start_telemetry(const char *path) {
+    static const char *state_names[AI_STATE_COUNT] = {"idle", "moving", "attacking", "retreating", "cover", "dying"};
+    static const char *team_names[2] = {"protester", "police"};
+    Telemetry *sink = &telemetry;
+    sink->file = fopen(path, "w");
+    if (!sink->file) return false;
+    fprintf(sink->file, "tick,protesters,police");
+    for (int t = 0; t < 2; t++) {
+        for (int k = 0; k < AI_STATE_COUNT; k++) fprintf(sink->file, ",%s_%s", team_names[t], state_names[k]);
+    }
+    fprintf(sink->file, ",protester_morale,police_morale,territory_hold,projectiles,tick_ms\n");
+    atomic_store(&sink->head, 0);
+    atomic_store(&sink->tail, 0);
+    atomic_store(&sink->stop, false);
+    sink->dropped = 0;
+    if (pthread_create(&sink->writer, NULL, telemetry_writer, sink) != 0) {
+        fclose(sink->file);
+        sink->file = NULL;
+        return false;
+    }
+    return true;
+}
+
+// Publishes the state after a tick. Call from the thread running the ticks;
+// it never waits on the writer.
+void record_telemetry(double tick_ms) {
+    Telemetry *sink = &telemetry;
+    if (!sink->file) return;
+    unsigned long head = atomic_load_explicit(&sink->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&sink->tail, memory_order_acquire) == TELEMETRY_RING_SIZE) {
+        sink->dropped++;
+        return;
+    }
+    TelemetrySample *sample = &sink->ring[head % TELEMETRY_RING_SIZE];
+    const TeamCounts *teams[2] = {&protester_counts, &police_counts};
+    sample->tick = game.tick;
+    for (int t = 0; t < 2; t++) {
+        sample->active[t] = atomic_load(&teams[t]->active);
+        for (int k = 0; k < AI_STATE_COUNT; k++) sample->states[t][k] = atomic_load(&teams[t]->state[k]);
+    }
+    sample->morale[PROTESTER] = game.protester_morale;
+    sample->morale[POLICE] = game.police_morale;
+    sample->territory_hold_timer = game.territory_hold_timer;
+    sample->projectiles = projectile_pool.live_count;
+    sample->tick_ms = (float)tick_ms;
+    atomic_store_explicit(&sink->head, head + 1, memory_order_release);
+}
+
+// Flushes the remaining samples and closes the file.
+void stop_telemetry() {
+    Telemetry *sink = &telemetry;
+    if (!sink->file) return;
+    atomic_store_explicit(&sink->stop, true, memory_order_release);
+    pthread_join(sink->writer, NULL);
+    fclose(sink->file);
+    sink->file = NULL;
+    if (sink->dropped > 0) fprintf(stderr, "telemetry: dropped %ld samples\n", sink->dropped);
+}
+
+#ifndef HEADLESS
+// Phase timings next to the HUD, toggled with F3. Draw stages only count
+// the CPU time spent issuing them.
+void draw_profiler() {
+    int x = SCREEN_WIDTH - 260, y = 40;
+    DrawRectangle(x - 10, y - 5, 260, 20 + 14 * PHASE_COUNT, Fade(BLACK, 0.6f));
+    DrawText("phase            avg ms   p99 ms", x, y, 10, WHITE);
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        float average, p99;
+        profile_stats(p, &average, &p99);
+        char line[64];
+        snprintf(line, sizeof(line), "%-16s %6.3f   %6.3f", phase_names[p], average, p99);
+        DrawText(line, x, y + 14 * (p + 1), 10, WHITE);
+    }
+}
+
 void draw_game() {
-    ClearBackground(GRAY);
-    draw_background();
-    draw_barriers();
+    int64_t start = profile_begin();
+    draw_static_layer();
+    profile_end(PHASE_DRAW_STATIC, start);
+    start = profile_begin();
     draw_entities();
+    profile_end(PHASE_DRAW_ENTITIES, start);
+    start = profile_begin();
     draw_projectiles();
+    profile_end(PHASE_DRAW_PROJECTILES, start);
+    start = profile_begin();
     draw_ui();
+    profile_end(PHASE_DRAW_UI, start);
+    if (profiler.enabled) draw_profiler();
+}
+
+PlayerInput read_player_input() {
+    PlayerInput input;
+    input.move_up = IsKeyDown(KEY_W);
+    input.move_down = IsKeyDown(KEY_S);
+    input.move_left = IsKeyDown(KEY_A);
+    input.move_right = IsKeyDown(KEY_D);
+    input.fire = IsMouseButtonPressed(MOUSE_BUTTON_LEFT);
+    input.select = IsMouseButtonPressed(MOUSE_BUTTON_RIGHT);
+    // Whole pixels, so a recording stores exactly what the match saw.
+    Vector2 mouse = GetMousePosition();
+    input.mouse_pos = (Vector2){roundf(mouse.x), roundf(mouse.y)};
+    return input;
 }
 
-int main() {
+// Usage: protest [--seed N] [--point-hits] [--ai-lod] [--record FILE | --replay FILE [--speed N]].
+// F3 shows phase timings. The simulation runs at FIXED_DT; each rendered
+// frame steps it as many times as the elapsed time requires. Restarting bumps
+// the seed, so every match of a session can be replayed from its seed.
+// --record saves the first match with its inputs; --replay plays one back
+// instead of taking input, N times faster than real time with --speed.
+// --snapshot starts every match from a saved state; F5 saves the current
+// one to the --save-snapshot path. --telemetry streams per-tick statistics
+// to a CSV file.
+int main(int argc, char **argv) {
+    uint64_t seed = (uint64_t)time(NULL);
+    int threads = default_thread_count();
+    const char *record_path = NULL, *replay_path = NULL;
+    const char *snapshot_path = NULL, *save_path = "protest.snap";
+    const char *telemetry_path = NULL;
+    int speed = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_path = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+            speed = atoi(argv[++i]);
+            if (speed < 1) speed = 1;
+        } else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+            snapshot_path = argv[++i];
+        } else if (strcmp(argv[i], "--save-snapshot") == 0 && i + 1 < argc) {
+            save_path = argv[++i];
+        } else if (strcmp(argv[i], "--telemetry") == 0 && i + 1 < argc) {
+            telemetry_path = argv[++i];
+        } else {
+            int used = parse_match_option(argc, argv, i);
+            if (used > 0) i += used - 1;
+        }
+    }
+    Replay recording = {0}, playback = {0};
+    if (replay_path && !start_playback(&playback, replay_path, &seed)) {
+        fprintf(stderr, "cannot read replay %s\n", replay_path);
+        return 1;
+    }
+    if (telemetry_path && !start_telemetry(telemetry_path)) {
+        fprintf(stderr, "cannot write telemetry %s\n", telemetry_path);
+    }
+    start_thread_pool(threads);
     InitWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "Protest Simulation");
     SetTargetFPS(60);
-    init_game();
+    init_circle_unit();
+    if (snapshot_path && !replay_path) {
+        if (!load_snapshot(snapshot_path)) {
+            fprintf(stderr, "cannot load snapshot %s\n", snapshot_path);
+            CloseWindow();
+            stop_thread_pool();
+            stop_telemetry();
+            return 1;
+        }
+        printf("Match from snapshot %s\n", snapshot_path);
+        if (record_path) fprintf(stderr, "--record needs a match that starts from its seed; not recording\n");
+        record_path = NULL;
+    } else {
+        init_game(seed);
+        printf("Match seed: %llu\n", (unsigned long long)seed);
+    }
+    if (replay_path) {
+        game.state = PLAYING;
+    } else if (record_path && !start_recording(&recording, record_path, seed)) {
+        fprintf(stderr, "cannot write replay %s\n", record_path);
+    }
+    bool replay_reported = false;
+    float accumulator = 0.0f;
+    PlayerInput pending = {0};
     while (!WindowShouldClose()) {
         BeginDrawing();
         switch (game.state) {
@@ -1017,20 +3985,453 @@ int main() {
                     game.state = PLAYING;
                 }
                 break;
-            case PLAYING:
-                update_game();
+            case PLAYING: {
+                // Clicks are edge events: keep them until a step consumes them.
+                PlayerInput input = read_player_input();
+                input.fire = input.fire || pending.fire;
+                input.select = input.select || pending.select;
+                accumulator += GetFrameTime() * speed;
+                int steps = 0;
+                while (accumulator >= FIXED_DT && steps < MAX_STEPS_PER_FRAME * speed && game.state == PLAYING) {
+                    if (replay_path) {
+                        if (replay_ended(&playback)) break;
+                        play_input(&playback, &input);
+                    }
+                    if (recording.file) record_input(&recording, &input);
+                    double tick_start = telemetry.file ? now_seconds() : 0.0;
+                    update_game(FIXED_DT, &input);
+                    if (telemetry.file) record_telemetry((now_seconds() - tick_start) * 1000.0);
+                    input.fire = false;
+                    input.select = false;
+                    accumulator -= FIXED_DT;
+                    steps++;
+                }
+                if (steps == MAX_STEPS_PER_FRAME * speed) accumulator = 0.0f;
+                if (game.state != PLAYING) stop_recording(&recording);
+                if (replay_path && !replay_reported && replay_ended(&playback)) {
+                    report_replay(&playback);
+                    replay_reported = true;
+                }
+                pending = input;
+                if (IsKeyPressed(KEY_F3)) set_profiling(!profiler.enabled);
+                if (IsKeyPressed(KEY_F5)) {
+                    if (save_snapshot(save_path)) {
+                        printf("Saved snapshot %s\n", save_path);
+                    } else {
+                        fprintf(stderr, "cannot write snapshot %s\n", save_path);
+                    }
+                }
                 draw_game();
+                profile_frame();
                 break;
+            }
             case PROTESTER_WIN:
             case POLICE_WIN:
                 draw_end_screen();
-                if (IsKeyPressed(KEY_SPACE)) {
-                    reset_game();
+                if (IsKeyPressed(KEY_SPACE) && !replay_path) {
+                    if (snapshot_path && load_snapshot(snapshot_path)) {
+                        printf("Match from snapshot %s\n", snapshot_path);
+                    } else {
+                        reset_game(++seed);
+                        printf("Match seed: %llu\n", (unsigned long long)seed);
+                    }
+                    accumulator = 0.0f;
+                    pending = (PlayerInput){0};
                 }
                 break;
         }
         EndDrawing();
     }
+    stop_recording(&recording);
+    stop_telemetry();
+    if (static_layer.id != 0) UnloadRenderTexture(static_layer);
     CloseWindow();
+    stop_thread_pool();
+    return 0;
+}
+#elif defined(BATCH)
+// Monte Carlo batch runner: plays --matches headless matches from seeds
+// --seed, --seed + 1, ... with no player input and prints outcome statistics
+// and throughput. The game state is global, so each of the --jobs workers is
+// a forked process with its own copy, playing one match at a time on its
+// share of the cores. Workers take the next match from a counter in shared memory
+// and write its outcome into a shared table. --outcomes also writes that
+// table as CSV, one row per seed.
+//   protest_batch [--seed N] [--matches N] [--jobs N] [--ticks N] [--point-hits] [--ai-lod]
+//                 [--protesters N] [--police N] [--barriers N] [--outcomes FILE]
+
+typedef struct {
+    GameState result;       // PLAYING if the tick limit ran out first
+    long ticks;
+    int protesters_lost;
+    int police_lost;
+    bool helicopter_down;
+    float longest_hold;     // longest unbroken territory hold, seconds
+    float total_hold;       // all time spent holding territory, seconds
+} MatchOutcome;
+
+typedef struct {
+    atomic_long next_match;
+    atomic_int failed_workers;
+    MatchOutcome outcomes[];
+} BatchTable;
+
+MatchOutcome play_batch_match(uint64_t seed, long max_ticks) {
+    PlayerInput input = {0};
+    MatchOutcome outcome = {0};
+    init_game(seed);
+    game.state = PLAYING;
+    while (game.state == PLAYING && outcome.ticks < max_ticks) {
+        update_game(FIXED_DT, &input);
+        outcome.ticks++;
+        if (game.territory_hold_timer > 0) outcome.total_hold += FIXED_DT;
+        if (game.territory_hold_timer > outcome.longest_hold) outcome.longest_hold = game.territory_hold_timer;
+    }
+    outcome.result = game.state;
+    outcome.protesters_lost = config.protester_count - fighting_units(&protester_counts);
+    outcome.police_lost = config.police_count - fighting_units(&police_counts);
+    outcome.helicopter_down = atomic_load(&police_counts.fighting[HELICOPTER]) == 0;
+    return outcome;
+}
+
+void batch_worker(BatchTable *table, long matches, uint64_t seed, long max_ticks, int threads) {
+    start_thread_pool(threads);
+    for (;;) {
+        long match = atomic_fetch_add(&table->next_match, 1);
+        if (match >= matches) break;
+        table->outcomes[match] = play_batch_match(seed + match, max_ticks);
+    }
+    stop_thread_pool();
+}
+
+bool write_outcomes(const char *path, const MatchOutcome *outcomes, long matches, uint64_t seed) {
+    FILE *file = fopen(path, "w");
+    if (!file) return false;
+    fprintf(file, "seed,winner,ticks,seconds,protesters_lost,police_lost,helicopter_down,longest_hold,total_hold\n");
+    for (long m = 0; m < matches; m++) {
+        const MatchOutcome *outcome = &outcomes[m];
+        const char *winner = outcome->result == PROTESTER_WIN ? "protesters" :
+                             outcome->result == POLICE_WIN ? "police" : "none";
+        fprintf(file, "%llu,%s,%ld,%.2f,%d,%d,%d,%.2f,%.2f\n", (unsigned long long)(seed + m), winner,
+                outcome->ticks, outcome->ticks * FIXED_DT, outcome->protesters_lost, outcome->police_lost,
+                outcome->helicopter_down, outcome->longest_hold, outcome->total_hold);
+    }
+    return fclose(file) == 0;
+}
+
+int main(int argc, char **argv) {
+    uint64_t seed = 1;
+    long matches = 1000;
+    long max_ticks = 60L * 60 * 10;
+    int jobs = default_thread_count();
+    const char *outcomes_path = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--matches") == 0 && i + 1 < argc) {
+            matches = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--ticks") == 0 && i + 1 < argc) {
+            max_ticks = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--outcomes") == 0 && i + 1 < argc) {
+            outcomes_path = argv[++i];
+        } else {
+            int used = parse_match_option(argc, argv, i);
+            if (used == 0) {
+                fprintf(stderr, "usage: %s [--seed N] [--matches N] [--jobs N] [--ticks N] [--point-hits] [--ai-lod]\n"
+                                "       [--protesters N] [--police N] [--barriers N] [--outcomes FILE]\n", argv[0]);
+                return 1;
+            }
+            i += used - 1;
+        }
+    }
+    if (matches < 1) matches = 1;
+    if (jobs < 1) jobs = 1;
+    if (jobs > matches) jobs = (int)matches;
+    int threads = default_thread_count() / jobs;
+    if (threads < 1) threads = 1;
+    size_t table_size = sizeof(BatchTable) + (size_t)matches * sizeof(MatchOutcome);
+    BatchTable *table = mmap(NULL, table_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (table == MAP_FAILED) {
+        fprintf(stderr, "cannot map an outcome table for %ld matches\n", matches);
+        return 1;
+    }
+    atomic_store(&table->next_match, 0);
+    atomic_store(&table->failed_workers, 0);
+    fflush(stdout);
+    double start = now_seconds();
+    int started = 0;
+    for (; started < jobs; started++) {
+        pid_t pid = fork();
+        if (pid < 0) break;
+        if (pid == 0) {
+            batch_worker(table, matches, seed, max_ticks, threads);
+            _exit(0);
+        }
+    }
+    for (int w = 0; w < started; w++) {
+        int status;
+        if (wait(&status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) atomic_fetch_add(&table->failed_workers, 1);
+    }
+    double elapsed = now_seconds() - start;
+    if (started == 0 || atomic_load(&table->failed_workers) > 0) {
+        fprintf(stderr, "%d of %d workers failed\n", started == 0 ? jobs : atomic_load(&table->failed_workers), jobs);
+        return 1;
+    }
+    long wins[POLICE_WIN + 1] = {0};
+    long helicopter_downs = 0;
+    double ticks = 0, protesters_lost = 0, police_lost = 0, longest_hold = 0, total_hold = 0;
+    for (long m = 0; m < matches; m++) {
+        const MatchOutcome *outcome = &table->outcomes[m];
+        wins[outcome->result]++;
+        helicopter_downs += outcome->helicopter_down;
+        ticks += outcome->ticks;
+        protesters_lost += outcome->protesters_lost;
+        police_lost += outcome->police_lost;
+        longest_hold += outcome->longest_hold;
+        total_hold += outcome->total_hold;
+    }
+    printf("matches: %ld (seeds %llu-%llu)\n", matches, (unsigned long long)seed,
+           (unsigned long long)(seed + matches - 1));
+    printf("jobs: %d\n", started);
+    printf("protester wins: %ld (%.1f%%)\n", wins[PROTESTER_WIN], 100.0 * wins[PROTESTER_WIN] / matches);
+    printf("police wins: %ld (%.1f%%)\n", wins[POLICE_WIN], 100.0 * wins[POLICE_WIN] / matches);
+    printf("unfinished: %ld (%.1f%%)\n", wins[PLAYING], 100.0 * wins[PLAYING] / matches);
+    printf("mean duration: %.1fs\n", ticks * FIXED_DT / matches);
+    printf("mean casualties: protesters %.1f, police %.1f\n", protesters_lost / matches, police_lost / matches);
+    printf("helicopter down: %ld (%.1f%%)\n", helicopter_downs, 100.0 * helicopter_downs / matches);
+    printf("territory hold: longest %.1fs, total %.1fs (means)\n", longest_hold / matches, total_hold / matches);
+    printf("wall time: %.3fs (%.1f matches/s, %.0f ticks/s)\n", elapsed,
+           elapsed > 0 ? matches / elapsed : 0.0, elapsed > 0 ? ticks / elapsed : 0.0);
+    bool ok = !outcomes_path || write_outcomes(outcomes_path, table->outcomes, matches, seed);
+    if (!ok) fprintf(stderr, "cannot write outcomes %s\n", outcomes_path);
+    munmap(table, table_size);
+    return ok ? 0 : 1;
+}
+#elif defined(BENCHMARK)
+// Scaling benchmark: plays the standard opening with N units per side for
+// each size in turn and times the ticks, no rendering and no input. Each
+// size stops after --ticks ticks or --budget seconds, whichever comes first,
+// and a match that ends early is cut short. --snapshot times a saved state
+// instead of the sizes. Prints JSON on stdout.
+//   protest_bench [--seed N] [--sizes N,N,...] [--ticks N] [--budget SECONDS]
+//                 [--threads N] [--point-hits] [--ai-lod] [--barriers N] [--snapshot FILE]
+#define BENCHMARK_WARMUP_TICKS 5
+
+int main(int argc, char **argv) {
+    uint64_t seed = 1;
+    int sizes[16] = {100, 1000, 10000, 50000};
+    int size_count = 4;
+    // Every timed tick of a run, per update phase, so the average and p99
+    // cover the same ticks. The profiler itself only keeps the last
+    // PROFILE_HISTORY.
+    float *phase_samples[PHASE_DRAW_STATIC] = {0};
+    long sample_capacity = 0;
+    long max_ticks = 300;
+    double budget = 20.0;
+    int threads = default_thread_count();
+    const char *snapshot_path = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--sizes") == 0 && i + 1 < argc) {
+            char *next = argv[++i];
+            for (size_count = 0; size_count < 16 && *next; size_count++) {
+                sizes[size_count] = (int)strtol(next, &next, 10);
+                if (*next == ',') next++;
+            }
+        } else if (strcmp(argv[i], "--ticks") == 0 && i + 1 < argc) {
+            max_ticks = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc) {
+            budget = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+            snapshot_path = argv[++i];
+            size_count = 1;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else {
+            int used = parse_match_option(argc, argv, i);
+            if (used == 0) {
+                fprintf(stderr, "usage: %s [--seed N] [--sizes N,N,...] [--ticks N] [--budget SECONDS]\n"
+                                "       [--threads N] [--point-hits] [--ai-lod] [--barriers N] [--snapshot FILE]\n", argv[0]);
+                return 1;
+            }
+            i += used - 1;
+        }
+    }
+    PlayerInput input = {0};
+    start_thread_pool(threads);
+    if (snapshot_path && !load_snapshot(snapshot_path)) {
+        fprintf(stderr, "cannot load snapshot %s\n", snapshot_path);
+        stop_thread_pool();
+        return 1;
+    }
+    printf("{\n  \"seed\": %llu,\n  \"threads\": %d,\n  \"swept_projectiles\": %s,\n  \"ai_lod\": %s,\n  \"dt\": %g,\n  \"runs\": [",
+           (unsigned long long)seed, thread_pool.worker_count + 1,
+           config.swept_projectiles ? "true" : "false", config.ai_lod ? "true" : "false", FIXED_DT);
+    for (int run = 0; run < size_count; run++) {
+        if (snapshot_path) {
+            sizes[run] = protesters.count;
+        } else {
+            config.protester_count = sizes[run];
+            config.police_count = sizes[run] > 1 ? sizes[run] : 1;
+            init_game(seed);
+        }
+        game.state = PLAYING;
+        double start = now_seconds();
+        for (int k = 0; k < BENCHMARK_WARMUP_TICKS && game.state == PLAYING && now_seconds() - start < budget / 4; k++) {
+            update_game(FIXED_DT, &input);
+        }
+        set_profiling(true);
+        long ticks = 0;
+        start = now_seconds();
+        double elapsed = 0.0;
+        while (game.state == PLAYING && ticks < max_ticks && (ticks == 0 || elapsed < budget)) {
+            update_game(FIXED_DT, &input);
+            profile_frame();
+            if (ticks == sample_capacity) {
+                sample_capacity = sample_capacity > 0 ? sample_capacity * 2 : 1024;
+                for (int p = 0; p < PHASE_DRAW_STATIC; p++) {
+                    phase_samples[p] = resize_array(phase_samples[p], sample_capacity, sizeof(float));
+                }
+            }
+            int last = (profiler.next + PROFILE_HISTORY - 1) % PROFILE_HISTORY;
+            for (int p = 0; p < PHASE_DRAW_STATIC; p++) phase_samples[p][ticks] = profiler.history[p][last];
+            ticks++;
+            elapsed = now_seconds() - start;
+        }
+        double ms_per_tick = ticks > 0 ? elapsed * 1000.0 / ticks : 0.0;
+        printf("%s\n    {\"per_side\": %d, \"barriers\": %d, \"ticks\": %ld, \"match_ended\": %s,\n",
+               run > 0 ? "," : "", sizes[run], barrier_count, ticks, game.state == PLAYING ? "false" : "true");
+        printf("     \"ms_per_tick\": %.4f, \"ticks_per_sec\": %.2f,\n     \"phases\": {",
+               ms_per_tick, elapsed > 0 ? ticks / elapsed : 0.0);
+        for (int p = 0; p < PHASE_DRAW_STATIC; p++) {
+            float average, p99;
+            timing_stats(phase_samples[p], (int)ticks, &average, &p99);
+            printf("%s\n       \"%s\": {\"avg_ms\": %.4f, \"p99_ms\": %.4f}", p > 0 ? "," : "",
+                   phase_names[p], average, p99);
+        }
+        printf("}}");
+        fflush(stdout);
+        set_profiling(false);
+    }
+    printf("\n  ]\n}\n");
+    for (int p = 0; p < PHASE_DRAW_STATIC; p++) free(phase_samples[p]);
+    stop_thread_pool();
+    return 0;
+}
+#else
+// Headless runner: steps one match with a fixed dt and no player input until
+// it ends or the tick limit is reached, as fast as the CPU allows. The same
+// seed and dt always produce the same checksum.
+// --profile prints per-phase timings for the last PROFILE_HISTORY ticks.
+// --replay plays a recording from the window build to its end, ignoring
+// --ticks and the match options, and checks the final checksum.
+// --snapshot starts from a saved state instead of the seed and match options;
+// --save-snapshot writes the state the run ends in. --telemetry streams
+// per-tick statistics to a CSV file.
+//   protest_headless [--seed N] [--ticks N] [--dt SECONDS] [--threads N] [--point-hits] [--ai-lod]
+//                    [--protesters N] [--police N] [--barriers N] [--profile] [--replay FILE]
+//                    [--snapshot FILE] [--save-snapshot FILE] [--telemetry FILE]
+int main(int argc, char **argv) {
+    uint64_t seed = (uint64_t)time(NULL);
+    long max_ticks = 60L * 60 * 10;
+    float dt = FIXED_DT;
+    int threads = default_thread_count();
+    bool profile = false;
+    const char *replay_path = NULL, *snapshot_path = NULL, *save_path = NULL;
+    const char *telemetry_path = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            profile = true;
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+            snapshot_path = argv[++i];
+        } else if (strcmp(argv[i], "--save-snapshot") == 0 && i + 1 < argc) {
+            save_path = argv[++i];
+        } else if (strcmp(argv[i], "--telemetry") == 0 && i + 1 < argc) {
+            telemetry_path = argv[++i];
+        } else if (strcmp(argv[i], "--ticks") == 0 && i + 1 < argc) {
+            max_ticks = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--dt") == 0 && i + 1 < argc) {
+            dt = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else {
+            int used = parse_match_option(argc, argv, i);
+            if (used == 0) {
+                fprintf(stderr, "usage: %s [--seed N] [--ticks N] [--dt SECONDS] [--threads N] [--point-hits] [--ai-lod]\n"
+                                "       [--protesters N] [--police N] [--barriers N] [--profile] [--replay FILE]\n"
+                                "       [--snapshot FILE] [--save-snapshot FILE] [--telemetry FILE]\n", argv[0]);
+                return 1;
+            }
+            i += used - 1;
+        }
+    }
+    Replay playback = {0};
+    if (replay_path) {
+        if (!start_playback(&playback, replay_path, &seed)) {
+            fprintf(stderr, "cannot read replay %s\n", replay_path);
+            return 1;
+        }
+        dt = FIXED_DT;
+    }
+    PlayerInput input = {0};
+    start_thread_pool(threads);
+    if (snapshot_path && !replay_path) {
+        if (!load_snapshot(snapshot_path)) {
+            fprintf(stderr, "cannot load snapshot %s\n", snapshot_path);
+            stop_thread_pool();
+            return 1;
+        }
+        seed = game.seed;
+        if (game.state == START) game.state = PLAYING;
+    } else {
+        init_game(seed);
+        game.state = PLAYING;
+    }
+    set_profiling(profile);
+    if (telemetry_path && !start_telemetry(telemetry_path)) {
+        fprintf(stderr, "cannot write telemetry %s\n", telemetry_path);
+    }
+    double start = now_seconds();
+    long ticks = 0;
+    while (game.state == PLAYING && (replay_path || ticks < max_ticks)) {
+        if (replay_path) {
+            if (replay_ended(&playback)) break;
+            play_input(&playback, &input);
+        }
+        double tick_start = telemetry.file ? now_seconds() : 0.0;
+        update_game(dt, &input);
+        if (telemetry.file) record_telemetry((now_seconds() - tick_start) * 1000.0);
+        profile_frame();
+        ticks++;
+    }
+    double elapsed = now_seconds() - start;
+    stop_telemetry();
+    const char *result = game.state == PROTESTER_WIN ? "protesters" :
+                         game.state == POLICE_WIN ? "police" : "none";
+    printf("seed: %llu\n", (unsigned long long)seed);
+    printf("winner: %s\n", result);
+    printf("ticks: %ld (%.1fs simulated)\n", ticks, ticks * dt);
+    printf("threads: %d\n", thread_pool.worker_count + 1);
+    printf("checksum: %016llx\n", (unsigned long long)state_checksum());
+    printf("wall time: %.3fs (%.0f ticks/s)\n", elapsed, elapsed > 0 ? ticks / elapsed : 0.0);
+    if (replay_path) {
+        replay_ended(&playback);
+        report_replay(&playback);
+    }
+    if (save_path && !save_snapshot(save_path)) fprintf(stderr, "cannot write snapshot %s\n", save_path);
+    for (int p = 0; profile && p < PHASE_DRAW_STATIC; p++) {
+        float average, p99;
+        profile_stats(p, &average, &p99);
+        printf("  %-16s avg %.3f ms  p99 %.3f ms\n", phase_names[p], average, p99);
+    }
+    stop_thread_pool();
     return 0;
-}
\ No newline at end of file
+}
+#endif